@@ -39,6 +39,22 @@ typedef struct {
   float scale;
 } AuroraWindowSize;
 
+typedef enum {
+  BUFFER_VERTEX,
+  BUFFER_UNIFORM,
+  BUFFER_INDEX,
+  BUFFER_STORAGE,
+  BUFFER_TEXTURE_UPLOAD,
+  BUFFER_CATEGORY_COUNT,
+} AuroraBufferCategory;
+
+typedef struct {
+  uint64_t reserved;        // GPU buffers
+  uint64_t reservedStaging; // Mapped staging buffers, across frames in flight
+  uint64_t used;            // Last frame
+  uint64_t highWater;       // Peak frame this session
+} AuroraBufferStats;
+
 typedef struct SDL_Window SDL_Window;
 typedef struct AuroraEvent AuroraEvent;
 
@@ -59,6 +75,34 @@ typedef struct {
   uint32_t iconHeight;
   AuroraLogCallback logCallback;
   AuroraImGuiInitCallback imGuiInitCallback;
+  uint32_t pipelineThreadCount;
+  uint32_t pipelineBudgetMs;
+  bool forceUbershader;
+  // Reorders opaque draws within a render pass by pipeline & textures. Output matches submission order except
+  // where two reordered draws cover a pixel at exactly equal depth.
+  bool sortOpaqueDraws;
+  // Initial per-frame buffer sizes in bytes. 0 sizes them from the last session's usage, saved
+  // under configPath, or defaults. Buffers grow & shrink with usage.
+  uint32_t vertexBufferSize;
+  uint32_t uniformBufferSize;
+  uint32_t indexBufferSize;
+  uint32_t storageBufferSize;
+  uint32_t textureUploadSize;
+  // Frames the CPU may record ahead of the GPU, 2-4 (0 for 3). Fewer lowers latency & staging memory.
+  uint32_t framesInFlight;
+  // aurora_begin_frame returns false instead of waiting while the GPU is framesInFlight frames behind
+  bool nonBlockingFrames;
+  // Packs per-draw uniform blocks tightly into a storage buffer indexed by the draw's first instance, instead of
+  // one uniform buffer binding per draw at a 256-byte aligned dynamic offset. Ubershader draws are unaffected.
+  bool perDrawStorage;
+  // Bind groups cached across frames before the least recently used are evicted (0 for 4096)
+  uint32_t bindGroupCacheSize;
+  // Bytes of converted display list geometry kept in GPU memory before the least recently used is evicted
+  // (0 for 64mb)
+  uint32_t displayListCacheSize;
+  // Still hashes display lists called with GXCallDisplayListStatic, warning about ones changed without
+  // GXInvalidateDisplayList
+  bool verifyDisplayLists;
 } AuroraConfig;
 
 typedef struct {
@@ -77,6 +121,20 @@ void aurora_end_frame();
 AuroraBackend aurora_get_backend();
 const AuroraBackend* aurora_get_available_backends(size_t* count);
 
+// Pipelines first used between begin & end are saved under the tag in the pipeline cache.
+void aurora_begin_pipeline_tag(const char* name);
+void aurora_end_pipeline_tag();
+// Builds a tag's cached pipelines in the background, ahead of the regular cache replay.
+// Returns the number of pipelines requested.
+uint32_t aurora_precompile_tag(const char* name);
+// 0-100, for loading screens
+float aurora_pipeline_tag_progress(const char* name);
+
+// Time the last frame waited for the GPU in aurora_begin_frame
+float aurora_get_gpu_wait_ms();
+// Per-frame buffer memory, indexed by AuroraBufferCategory
+void aurora_get_buffer_stats(AuroraBufferStats stats[BUFFER_CATEGORY_COUNT]);
+
 #ifndef NDEBUG
 #define AURORA_GFX_DEBUG_GROUPS
 #endif
@@ -26,6 +26,13 @@ void GXDestroyTlutObj(GXTlutObj* obj);
 
 void GXColor4f32(float r, float g, float b, float a);
 
+// Like GXCallDisplayList, but the converted list is looked up by address & size instead of hashing its contents on
+// every call. Call GXInvalidateDisplayList after modifying or freeing the list's memory.
+void GXCallDisplayListStatic(const void* data, u32 nbytes);
+void GXInvalidateDisplayList(const void* data);
+// Invalidates every list called with GXCallDisplayListStatic
+void GXInvalidateDisplayLists(void);
+
 #ifdef __cplusplus
 }
 #endif
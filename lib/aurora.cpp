@@ -10,6 +10,8 @@
 #include <SDL.h>
 #include <SDL_filesystem.h>
 #include <imgui.h>
+#include <algorithm>
+#include <thread>
 
 namespace aurora {
 static Module Log("aurora");
@@ -61,6 +63,12 @@ static AuroraInfo initialize(int argc, char* argv[], const AuroraConfig& config)
   if (g_config.maxTextureAnisotropy == 0) {
     g_config.maxTextureAnisotropy = 16;
   }
+  if (g_config.pipelineThreadCount == 0) {
+    g_config.pipelineThreadCount = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+  }
+  if (g_config.pipelineBudgetMs == 0) {
+    g_config.pipelineBudgetMs = 4;
+  }
   window::initialize();
 
   /* Attempt to create a window using the calling application's desired backend */
@@ -146,6 +154,11 @@ static const AuroraEvent* update() noexcept {
 }
 
 static bool begin_frame() noexcept {
+  if (!gfx::frame_ready(!g_config.nonBlockingFrames)) {
+    // GPU is still using the next frame's staging buffers
+    ImGui::EndFrame();
+    return false;
+  }
 #ifndef EMSCRIPTEN
   g_currentView = g_swapChain.GetCurrentTextureView();
   if (!g_currentView) {
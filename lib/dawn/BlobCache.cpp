@@ -0,0 +1,219 @@
+#include "BlobCache.hpp"
+
+#include "../internal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <xxhash_impl.h>
+
+namespace aurora::webgpu::utils {
+static Module Log("aurora::webgpu::BlobCache");
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t BlobMagic = 0x424F4C42; // BLOB
+constexpr uint32_t BlobVersion = 1;
+struct BlobHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t keySize;
+  uint64_t valueSize;
+  uint64_t valueHash;
+};
+static_assert(sizeof(BlobHeader) == 32);
+
+static std::string blob_name(const void* key, size_t keySize) {
+  const auto hash = XXH3_128bits(key, keySize);
+  return fmt::format(FMT_STRING("{:016x}{:016x}"), hash.high64, hash.low64);
+}
+
+BlobCache::BlobCache(fs::path dir, uint64_t maxSize) : m_dir(std::move(dir)), m_maxSize(maxSize) {
+  std::error_code ec;
+  fs::create_directories(m_dir, ec);
+  if (ec) {
+    Log.report(LOG_WARNING, FMT_STRING("Failed to create {}: {}"), m_dir.string(), ec.message());
+    return;
+  }
+  for (const auto& item : fs::directory_iterator{m_dir, ec}) {
+    if (!item.is_regular_file(ec)) {
+      continue;
+    }
+    if (item.path().extension() == ".tmp") {
+      // Left over from an interrupted write
+      fs::remove(item.path(), ec);
+      continue;
+    }
+    const auto size = item.file_size(ec);
+    if (ec) {
+      continue;
+    }
+    m_entries.try_emplace(item.path().filename().string(), Entry{size, item.last_write_time(ec)});
+    m_totalSize += size;
+  }
+  std::scoped_lock lock{m_mutex};
+  evict();
+  Log.report(LOG_INFO, FMT_STRING("Opened blob cache {} ({} entries, {} KiB)"), m_dir.string(), m_entries.size(),
+             m_totalSize / 1024);
+}
+
+size_t BlobCache::LoadData(const void* key, size_t keySize, void* value, size_t valueSize) {
+  const auto name = blob_name(key, keySize);
+  {
+    std::scoped_lock lock{m_mutex};
+    if (!m_entries.contains(name)) {
+      ++misses;
+      return 0;
+    }
+  }
+  const auto path = m_dir / name;
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  BlobHeader header{};
+  std::vector<char> storedKey(keySize);
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != BlobMagic ||
+      header.version != BlobVersion || header.keySize != keySize || !file.read(storedKey.data(), keySize) ||
+      memcmp(storedKey.data(), key, keySize) != 0) {
+    // Corrupt or a hash collision, the next store replaces it
+    file.close();
+    remove(name);
+    ++misses;
+    return 0;
+  }
+  if (value == nullptr) {
+    // Size query
+    return header.valueSize;
+  }
+  if (valueSize != header.valueSize || !file.read(static_cast<char*>(value), valueSize) ||
+      XXH3_64bits(value, valueSize) != header.valueHash) {
+    file.close();
+    remove(name);
+    ++misses;
+    return 0;
+  }
+  file.close();
+  ++hits;
+
+  const auto now = fs::file_time_type::clock::now();
+  {
+    std::scoped_lock lock{m_mutex};
+    const auto it = m_entries.find(name);
+    if (it != m_entries.end()) {
+      it->second.lastUse = now;
+    }
+  }
+  // Persist recency for eviction in later runs
+  std::error_code ec;
+  fs::last_write_time(path, now, ec);
+  return valueSize;
+}
+
+void BlobCache::StoreData(const void* key, size_t keySize, const void* value, size_t valueSize) {
+  const auto name = blob_name(key, keySize);
+  const auto path = m_dir / name;
+  const auto tmpPath = m_dir / fmt::format(FMT_STRING("{}.{}.tmp"), name, m_tmpCounter++);
+  const BlobHeader header{
+      .magic = BlobMagic,
+      .version = BlobVersion,
+      .keySize = keySize,
+      .valueSize = valueSize,
+      .valueHash = XXH3_64bits(value, valueSize),
+  };
+  std::error_code ec;
+  {
+    std::ofstream file(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(static_cast<const char*>(key), keySize);
+    file.write(static_cast<const char*>(value), valueSize);
+    file.close();
+    if (!file) {
+      Log.report(LOG_WARNING, FMT_STRING("Failed to write {}"), tmpPath.string());
+      fs::remove(tmpPath, ec);
+      return;
+    }
+  }
+  // Readers only ever see complete entries
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    Log.report(LOG_WARNING, FMT_STRING("Failed to rename {}: {}"), tmpPath.string(), ec.message());
+    fs::remove(tmpPath, ec);
+    return;
+  }
+  ++stores;
+
+  const uint64_t size = sizeof(header) + keySize + valueSize;
+  std::scoped_lock lock{m_mutex};
+  auto& entry = m_entries[name];
+  m_totalSize = m_totalSize - entry.size + size;
+  entry = {size, fs::file_time_type::clock::now()};
+  evict();
+}
+
+void BlobCache::remove(const std::string& name) {
+  std::error_code ec;
+  fs::remove(m_dir / name, ec);
+  std::scoped_lock lock{m_mutex};
+  const auto it = m_entries.find(name);
+  if (it != m_entries.end()) {
+    m_totalSize -= it->second.size;
+    m_entries.erase(it);
+  }
+}
+
+// Requires m_mutex
+void BlobCache::evict() {
+  if (m_totalSize <= m_maxSize) {
+    return;
+  }
+  std::vector<std::pair<fs::file_time_type, std::string>> order;
+  order.reserve(m_entries.size());
+  for (const auto& [name, entry] : m_entries) {
+    order.emplace_back(entry.lastUse, name);
+  }
+  std::sort(order.begin(), order.end());
+  // Evict down to 90% so we don't evict again on the next store
+  const uint64_t target = m_maxSize / 10 * 9;
+  size_t evicted = 0;
+  std::error_code ec;
+  for (const auto& [lastUse, name] : order) {
+    if (m_totalSize <= target) {
+      break;
+    }
+    fs::remove(m_dir / name, ec);
+    m_totalSize -= m_entries[name].size;
+    m_entries.erase(name);
+    ++evicted;
+  }
+  Log.report(LOG_INFO, FMT_STRING("Evicted {} blob cache entries"), evicted);
+}
+
+BlobCachePlatform::BlobCachePlatform(fs::path root, uint64_t maxSize) : m_root(std::move(root)), m_maxSize(maxSize) {}
+
+void BlobCachePlatform::SetAdapter(const wgpu::AdapterProperties& properties) {
+  m_adapterKey = fmt::format(FMT_STRING("{}:{:x}:{:x}:{}:{}"), static_cast<int>(properties.backendType),
+                             properties.vendorID, properties.deviceID,
+                             properties.name != nullptr ? properties.name : "",
+                             properties.driverDescription != nullptr ? properties.driverDescription : "");
+}
+
+dawn::platform::CachingInterface* BlobCachePlatform::GetCachingInterface(const void* fingerprint,
+                                                                          size_t fingerprintSize) {
+  std::string key{static_cast<const char*>(fingerprint), fingerprintSize};
+  key += m_adapterKey;
+  const auto name = fmt::format(FMT_STRING("{:016x}"), XXH3_64bits(key.data(), key.size()));
+  if (m_cache && name == m_cacheName) {
+    return m_cache.get();
+  }
+  // Entries from another Dawn version, adapter or driver can't be reused
+  std::error_code ec;
+  for (const auto& item : fs::directory_iterator{m_root, ec}) {
+    if (item.is_directory(ec) && item.path().filename() != name) {
+      fs::remove_all(item.path(), ec);
+    }
+  }
+  m_cacheName = name;
+  m_cache = std::make_unique<BlobCache>(m_root / name, m_maxSize);
+  return m_cache.get();
+}
+
+} // namespace aurora::webgpu::utils
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <dawn/platform/DawnPlatform.h>
+#include <webgpu/webgpu_cpp.h>
+
+#include <absl/container/flat_hash_map.h>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace aurora::webgpu::utils {
+
+// On-disk store for Dawn's compiled backend shaders & pipelines.
+// Each entry is a file named by the hash of its key; writes go through a temporary file + rename,
+// and the least recently used entries are evicted once the store exceeds maxSize.
+class BlobCache final : public dawn::platform::CachingInterface {
+public:
+  BlobCache(std::filesystem::path dir, uint64_t maxSize);
+
+  size_t LoadData(const void* key, size_t keySize, void* value, size_t valueSize) override;
+  void StoreData(const void* key, size_t keySize, const void* value, size_t valueSize) override;
+
+  // for logging
+  std::atomic_uint32_t hits = 0;
+  std::atomic_uint32_t misses = 0;
+  std::atomic_uint32_t stores = 0;
+
+private:
+  struct Entry {
+    uint64_t size;
+    std::filesystem::file_time_type lastUse;
+  };
+
+  void remove(const std::string& name);
+  void evict();
+
+  std::filesystem::path m_dir;
+  uint64_t m_maxSize;
+  std::mutex m_mutex;
+  absl::flat_hash_map<std::string, Entry> m_entries;
+  uint64_t m_totalSize = 0;
+  std::atomic_uint32_t m_tmpCounter = 0;
+};
+
+// Hands Dawn a BlobCache in <root>/<fingerprint>. The directory is keyed by Dawn's own fingerprint
+// (which covers the Dawn version) plus the adapter & driver, so any change starts from an empty cache.
+class BlobCachePlatform final : public dawn::platform::Platform {
+public:
+  BlobCachePlatform(std::filesystem::path root, uint64_t maxSize);
+
+  // Must be called before the device is created
+  void SetAdapter(const wgpu::AdapterProperties& properties);
+  BlobCache* GetBlobCache() const { return m_cache.get(); }
+
+  dawn::platform::CachingInterface* GetCachingInterface(const void* fingerprint, size_t fingerprintSize) override;
+
+private:
+  std::filesystem::path m_root;
+  uint64_t m_maxSize;
+  std::string m_adapterKey;
+  std::string m_cacheName;
+  std::unique_ptr<BlobCache> m_cache;
+};
+
+} // namespace aurora::webgpu::utils
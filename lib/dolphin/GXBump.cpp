@@ -1,51 +1,52 @@
 #include "gx.hpp"
 
-void GXSetNumIndStages(u8 num) { update_gx_state(g_gxState.numIndStages, num); }
+void GXSetNumIndStages(u8 num) { update_gx_state(g_gxState.numIndStages, num, DirtyPipeline); }
 
 void GXSetIndTexOrder(GXIndTexStageID indStage, GXTexCoordID texCoord, GXTexMapID texMap) {
   auto& stage = g_gxState.indStages[indStage];
-  update_gx_state(stage.texCoordId, texCoord);
-  update_gx_state(stage.texMapId, texMap);
+  update_gx_state(stage.texCoordId, texCoord, DirtyPipeline);
+  update_gx_state(stage.texMapId, texMap, DirtyPipeline);
 }
 
 void GXSetIndTexCoordScale(GXIndTexStageID indStage, GXIndTexScale scaleS, GXIndTexScale scaleT) {
   auto& stage = g_gxState.indStages[indStage];
-  update_gx_state(stage.scaleS, scaleS);
-  update_gx_state(stage.scaleT, scaleT);
+  update_gx_state(stage.scaleS, scaleS, DirtyPipeline);
+  update_gx_state(stage.scaleT, scaleT, DirtyPipeline);
 }
 
 void GXSetIndTexMtx(GXIndTexMtxID id, const void* offset, s8 scaleExp) {
   CHECK(id >= GX_ITM_0 && id <= GX_ITM_2, "invalid ind tex mtx ID {}", static_cast<int>(id));
-  update_gx_state(g_gxState.indTexMtxs[id - 1], {*reinterpret_cast<const aurora::Mat3x2<float>*>(offset), scaleExp});
+  update_gx_state(g_gxState.indTexMtxs[id - 1], {*reinterpret_cast<const aurora::Mat3x2<float>*>(offset), scaleExp},
+                  DirtyTevConstants);
 }
 
 void GXSetTevIndirect(GXTevStageID tevStage, GXIndTexStageID indStage, GXIndTexFormat fmt, GXIndTexBiasSel biasSel,
                       GXIndTexMtxID matrixSel, GXIndTexWrap wrapS, GXIndTexWrap wrapT, GXBool addPrev, GXBool indLod,
                       GXIndTexAlphaSel alphaSel) {
   auto& stage = g_gxState.tevStages[tevStage];
-  update_gx_state(stage.indTexStage, indStage);
-  update_gx_state(stage.indTexFormat, fmt);
-  update_gx_state(stage.indTexBiasSel, biasSel);
-  update_gx_state(stage.indTexAlphaSel, alphaSel);
-  update_gx_state(stage.indTexMtxId, matrixSel);
-  update_gx_state(stage.indTexWrapS, wrapS);
-  update_gx_state(stage.indTexWrapT, wrapT);
-  update_gx_state(stage.indTexAddPrev, addPrev);
-  update_gx_state(stage.indTexUseOrigLOD, indLod);
+  update_gx_state(stage.indTexStage, indStage, DirtyPipeline);
+  update_gx_state(stage.indTexFormat, fmt, DirtyPipeline);
+  update_gx_state(stage.indTexBiasSel, biasSel, DirtyPipeline);
+  update_gx_state(stage.indTexAlphaSel, alphaSel, DirtyPipeline);
+  update_gx_state(stage.indTexMtxId, matrixSel, DirtyPipeline);
+  update_gx_state(stage.indTexWrapS, wrapS, DirtyPipeline);
+  update_gx_state(stage.indTexWrapT, wrapT, DirtyPipeline);
+  update_gx_state(stage.indTexAddPrev, addPrev, DirtyPipeline);
+  update_gx_state(stage.indTexUseOrigLOD, indLod, DirtyPipeline);
 }
 
 void GXSetTevDirect(GXTevStageID stageId) {
   auto& stage = g_gxState.tevStages[stageId];
   // TODO is this right?
-  update_gx_state(stage.indTexStage, GX_INDTEXSTAGE0);
-  update_gx_state(stage.indTexFormat, GX_ITF_8);
-  update_gx_state(stage.indTexBiasSel, GX_ITB_NONE);
-  update_gx_state(stage.indTexAlphaSel, GX_ITBA_OFF);
-  update_gx_state(stage.indTexMtxId, GX_ITM_OFF);
-  update_gx_state(stage.indTexWrapS, GX_ITW_OFF);
-  update_gx_state(stage.indTexWrapT, GX_ITW_OFF);
-  update_gx_state(stage.indTexUseOrigLOD, false);
-  update_gx_state(stage.indTexAddPrev, false);
+  update_gx_state(stage.indTexStage, GX_INDTEXSTAGE0, DirtyPipeline);
+  update_gx_state(stage.indTexFormat, GX_ITF_8, DirtyPipeline);
+  update_gx_state(stage.indTexBiasSel, GX_ITB_NONE, DirtyPipeline);
+  update_gx_state(stage.indTexAlphaSel, GX_ITBA_OFF, DirtyPipeline);
+  update_gx_state(stage.indTexMtxId, GX_ITM_OFF, DirtyPipeline);
+  update_gx_state(stage.indTexWrapS, GX_ITW_OFF, DirtyPipeline);
+  update_gx_state(stage.indTexWrapT, GX_ITW_OFF, DirtyPipeline);
+  update_gx_state(stage.indTexUseOrigLOD, false, DirtyPipeline);
+  update_gx_state(stage.indTexAddPrev, false, DirtyPipeline);
 }
 
 void GXSetTevIndWarp(GXTevStageID tevStage, GXIndTexStageID indStage, GXBool signedOffsets, GXBool replaceMode,
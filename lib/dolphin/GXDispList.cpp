@@ -12,5 +12,15 @@ u32 GXEndDisplayList() {
 }
 
 void GXCallDisplayList(const void* data, u32 nbytes) {
-  aurora::gfx::model::queue_surface(static_cast<const u8*>(data), nbytes);
+  aurora::gfx::model::queue_surface(static_cast<const u8*>(data), nbytes, false);
 }
+
+void GXCallDisplayListStatic(const void* data, u32 nbytes) {
+  aurora::gfx::model::queue_surface(static_cast<const u8*>(data), nbytes, true);
+}
+
+void GXInvalidateDisplayList(const void* data) {
+  aurora::gfx::model::invalidate_display_list(static_cast<const u8*>(data));
+}
+
+void GXInvalidateDisplayLists() { aurora::gfx::model::invalidate_display_lists(); }
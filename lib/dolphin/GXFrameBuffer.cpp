@@ -39,7 +39,8 @@ void GXSetTexCopyDst(u16 wd, u16 ht, GXTexFmt fmt, GXBool mipmap) {
 
 u32 GXSetDispCopyYScale(f32 vscale) { return 0; }
 
-void GXSetCopyClear(GXColor color, u32 depth) { update_gx_state(g_gxState.clearColor, from_gx_color(color)); }
+// Only read when a render pass is started, never by draws
+void GXSetCopyClear(GXColor color, u32 depth) { g_gxState.clearColor = from_gx_color(color); }
 
 void GXSetCopyFilter(GXBool aa, u8 sample_pattern[12][2], GXBool vf, u8 vfilter[7]) {}
 
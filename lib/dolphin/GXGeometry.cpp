@@ -2,12 +2,12 @@
 
 #include <optional>
 
-void GXSetVtxDesc(GXAttr attr, GXAttrType type) { update_gx_state(g_gxState.vtxDesc[attr], type); }
+void GXSetVtxDesc(GXAttr attr, GXAttrType type) { update_gx_state(g_gxState.vtxDesc[attr], type, DirtyPipeline); }
 
 void GXSetVtxDescv(GXVtxDescList* list) {
   g_gxState.vtxDesc.fill({});
   while (list->attr != GX_VA_NULL) {
-    update_gx_state(g_gxState.vtxDesc[list->attr], list->type);
+    update_gx_state(g_gxState.vtxDesc[list->attr], list->type, DirtyPipeline);
     ++list;
   }
 }
@@ -18,19 +18,22 @@ void GXSetVtxAttrFmt(GXVtxFmt vtxfmt, GXAttr attr, GXCompCnt cnt, GXCompType typ
   CHECK(vtxfmt >= GX_VTXFMT0 && vtxfmt < GX_MAX_VTXFMT, "invalid vtxfmt {}", static_cast<int>(vtxfmt));
   CHECK(attr >= GX_VA_PNMTXIDX && attr < GX_VA_MAX_ATTR, "invalid attr {}", static_cast<int>(attr));
   auto& fmt = g_gxState.vtxFmts[vtxfmt].attrs[attr];
-  update_gx_state(fmt.cnt, cnt);
-  update_gx_state(fmt.type, type);
-  update_gx_state(fmt.frac, frac);
+  update_gx_state(fmt.cnt, cnt, DirtyPipeline);
+  update_gx_state(fmt.type, type, DirtyPipeline);
+  update_gx_state(fmt.frac, frac, DirtyPipeline);
 }
 
 // TODO GXSetVtxAttrFmtv
 
 void GXSetArray(GXAttr attr, const void* data, u32 size, u8 stride) {
   auto& array = g_gxState.arrays[attr];
-  update_gx_state(array.data, data);
-  update_gx_state(array.size, size);
-  update_gx_state(array.stride, stride);
-  array.cachedRange = {};
+  if (array.data != data || array.size != size) {
+    // Uploaded contents stay cached until the array changes or GXInvalidateVtxCache
+    array.cachedRange = {};
+  }
+  update_gx_state(array.data, data, DirtyVtxArrays);
+  update_gx_state(array.size, size, DirtyVtxArrays);
+  update_gx_state(array.stride, stride, DirtyVtxArrays);
 }
 
 // TODO move GXBegin, GXEnd here
@@ -38,13 +41,16 @@ void GXSetArray(GXAttr attr, const void* data, u32 size, u8 stride) {
 void GXSetTexCoordGen2(GXTexCoordID dst, GXTexGenType type, GXTexGenSrc src, u32 mtx, GXBool normalize, u32 postMtx) {
   CHECK(dst >= GX_TEXCOORD0 && dst <= GX_TEXCOORD7, "invalid tex coord {}", static_cast<int>(dst));
   update_gx_state(g_gxState.tcgs[dst],
-                  {type, src, static_cast<GXTexMtx>(mtx), static_cast<GXPTTexMtx>(postMtx), normalize});
+                  {type, src, static_cast<GXTexMtx>(mtx), static_cast<GXPTTexMtx>(postMtx), normalize}, DirtyPipeline);
 }
 
-void GXSetNumTexGens(u8 num) { update_gx_state(g_gxState.numTexGens, num); }
+void GXSetNumTexGens(u8 num) { update_gx_state(g_gxState.numTexGens, num, DirtyPipeline); }
 
 void GXInvalidateVtxCache() {
-  // TODO
+  // Array contents may have changed in place, look them up again on next use
+  for (auto& array : g_gxState.arrays) {
+    array.cachedRange = {};
+  }
 }
 
 void GXSetLineWidth(u8 width, GXTexOffset offs) {
@@ -137,7 +137,7 @@ void GXLoadLightObjImm(GXLightObj* light_, GXLightID id) {
   realLight.color = from_gx_color(light->color);
   realLight.cosAtt = {light->a0, light->a1, light->a2};
   realLight.distAtt = {light->k0, light->k1, light->k2};
-  update_gx_state(g_gxState.lights[idx], realLight);
+  update_gx_state(g_gxState.lights[idx], realLight, DirtyLights);
 }
 
 // TODO GXLoadLightObjIndx
@@ -153,7 +153,7 @@ void GXSetChanAmbColor(GXChannelID id, GXColor color) {
     return;
   }
   CHECK(id >= GX_COLOR0 && id <= GX_ALPHA1, "bad channel {}", static_cast<int>(id));
-  update_gx_state(g_gxState.colorChannelState[id].ambColor, from_gx_color(color));
+  update_gx_state(g_gxState.colorChannelState[id].ambColor, from_gx_color(color), DirtyLights);
 }
 
 void GXSetChanMatColor(GXChannelID id, GXColor color) {
@@ -167,10 +167,10 @@ void GXSetChanMatColor(GXChannelID id, GXColor color) {
     return;
   }
   CHECK(id >= GX_COLOR0 && id <= GX_ALPHA1, "bad channel {}", static_cast<int>(id));
-  update_gx_state(g_gxState.colorChannelState[id].matColor, from_gx_color(color));
+  update_gx_state(g_gxState.colorChannelState[id].matColor, from_gx_color(color), DirtyLights);
 }
 
-void GXSetNumChans(u8 num) { update_gx_state(g_gxState.numChans, num); }
+void GXSetNumChans(u8 num) { update_gx_state(g_gxState.numChans, num, DirtyPipeline); }
 
 void GXInitLightDir(GXLightObj* light_, float nx, float ny, float nz) {
   auto* light = reinterpret_cast<GXLightObj_*>(light_);
@@ -220,10 +220,11 @@ void GXSetChanCtrl(GXChannelID id, bool lightingEnabled, GXColorSrc ambSrc, GXCo
   }
   CHECK(id >= GX_COLOR0 && id <= GX_ALPHA1, "bad channel {}", static_cast<int>(id));
   auto& chan = g_gxState.colorChannelConfig[id];
-  update_gx_state(chan.lightingEnabled, lightingEnabled);
-  update_gx_state(chan.ambSrc, ambSrc);
-  update_gx_state(chan.matSrc, matSrc);
-  update_gx_state(chan.diffFn, diffFn);
-  update_gx_state(chan.attnFn, attnFn);
-  update_gx_state(g_gxState.colorChannelState[id].lightMask, GX::LightMask{lightState});
+  update_gx_state(chan.lightingEnabled, lightingEnabled, DirtyPipeline);
+  update_gx_state(chan.ambSrc, ambSrc, DirtyPipeline);
+  update_gx_state(chan.matSrc, matSrc, DirtyPipeline);
+  update_gx_state(chan.diffFn, diffFn, DirtyPipeline);
+  update_gx_state(chan.attnFn, attnFn, DirtyPipeline);
+  // The number of lit lights sizes the pipeline's lights array
+  update_gx_state(g_gxState.colorChannelState[id].lightMask, GX::LightMask{lightState}, DirtyLights | DirtyPipeline);
 }
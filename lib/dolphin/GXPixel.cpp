@@ -1,29 +1,35 @@
 #include "gx.hpp"
 
 void GXSetFog(GXFogType type, float startZ, float endZ, float nearZ, float farZ, GXColor color) {
-  update_gx_state(g_gxState.fog, {type, startZ, endZ, nearZ, farZ, from_gx_color(color)});
+  auto& fog = g_gxState.fog;
+  update_gx_state(fog.type, type, DirtyPipeline);
+  update_gx_state(fog.startZ, startZ, DirtyTevConstants);
+  update_gx_state(fog.endZ, endZ, DirtyTevConstants);
+  update_gx_state(fog.nearZ, nearZ, DirtyTevConstants);
+  update_gx_state(fog.farZ, farZ, DirtyTevConstants);
+  update_gx_state(fog.color, from_gx_color(color), DirtyTevConstants);
 }
 
-void GXSetFogColor(GXColor color) { update_gx_state(g_gxState.fog.color, from_gx_color(color)); }
+void GXSetFogColor(GXColor color) { update_gx_state(g_gxState.fog.color, from_gx_color(color), DirtyTevConstants); }
 
 // TODO GXInitFogAdjTable
 // TODO GXSetFogRangeAdj
 
 void GXSetBlendMode(GXBlendMode mode, GXBlendFactor src, GXBlendFactor dst, GXLogicOp op) {
-  update_gx_state(g_gxState.blendMode, mode);
-  update_gx_state(g_gxState.blendFacSrc, src);
-  update_gx_state(g_gxState.blendFacDst, dst);
-  update_gx_state(g_gxState.blendOp, op);
+  update_gx_state(g_gxState.blendMode, mode, DirtyPipeline);
+  update_gx_state(g_gxState.blendFacSrc, src, DirtyPipeline);
+  update_gx_state(g_gxState.blendFacDst, dst, DirtyPipeline);
+  update_gx_state(g_gxState.blendOp, op, DirtyPipeline);
 }
 
-void GXSetColorUpdate(GXBool enabled) { update_gx_state(g_gxState.colorUpdate, enabled); }
+void GXSetColorUpdate(GXBool enabled) { update_gx_state(g_gxState.colorUpdate, enabled, DirtyPipeline); }
 
-void GXSetAlphaUpdate(bool enabled) { update_gx_state(g_gxState.alphaUpdate, enabled); }
+void GXSetAlphaUpdate(bool enabled) { update_gx_state(g_gxState.alphaUpdate, enabled, DirtyPipeline); }
 
 void GXSetZMode(bool compare_enable, GXCompare func, bool update_enable) {
-  update_gx_state(g_gxState.depthCompare, compare_enable);
-  update_gx_state(g_gxState.depthFunc, func);
-  update_gx_state(g_gxState.depthUpdate, update_enable);
+  update_gx_state(g_gxState.depthCompare, compare_enable, DirtyPipeline);
+  update_gx_state(g_gxState.depthFunc, func, DirtyPipeline);
+  update_gx_state(g_gxState.depthUpdate, update_enable, DirtyPipeline);
 }
 
 void GXSetZCompLoc(GXBool before_tex) {
@@ -36,9 +42,9 @@ void GXSetDither(GXBool dither) {}
 
 void GXSetDstAlpha(bool enabled, u8 value) {
   if (enabled) {
-    update_gx_state<u32>(g_gxState.dstAlpha, value);
+    update_gx_state<u32>(g_gxState.dstAlpha, value, DirtyPipeline);
   } else {
-    update_gx_state(g_gxState.dstAlpha, UINT32_MAX);
+    update_gx_state(g_gxState.dstAlpha, UINT32_MAX, DirtyPipeline);
   }
 }
 
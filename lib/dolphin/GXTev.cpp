@@ -34,69 +34,75 @@ void GXSetTevOp(GXTevStageID id, GXTevMode mode) {
 }
 
 void GXSetTevColorIn(GXTevStageID stageId, GXTevColorArg a, GXTevColorArg b, GXTevColorArg c, GXTevColorArg d) {
-  update_gx_state(g_gxState.tevStages[stageId].colorPass, {a, b, c, d});
+  update_gx_state(g_gxState.tevStages[stageId].colorPass, {a, b, c, d}, DirtyPipeline);
 }
 
 void GXSetTevAlphaIn(GXTevStageID stageId, GXTevAlphaArg a, GXTevAlphaArg b, GXTevAlphaArg c, GXTevAlphaArg d) {
-  update_gx_state(g_gxState.tevStages[stageId].alphaPass, {a, b, c, d});
+  update_gx_state(g_gxState.tevStages[stageId].alphaPass, {a, b, c, d}, DirtyPipeline);
 }
 
 void GXSetTevColorOp(GXTevStageID stageId, GXTevOp op, GXTevBias bias, GXTevScale scale, bool clamp,
                      GXTevRegID outReg) {
-  update_gx_state(g_gxState.tevStages[stageId].colorOp, {op, bias, scale, outReg, clamp});
+  update_gx_state(g_gxState.tevStages[stageId].colorOp, {op, bias, scale, outReg, clamp}, DirtyPipeline);
 }
 
 void GXSetTevAlphaOp(GXTevStageID stageId, GXTevOp op, GXTevBias bias, GXTevScale scale, bool clamp,
                      GXTevRegID outReg) {
-  update_gx_state(g_gxState.tevStages[stageId].alphaOp, {op, bias, scale, outReg, clamp});
+  update_gx_state(g_gxState.tevStages[stageId].alphaOp, {op, bias, scale, outReg, clamp}, DirtyPipeline);
 }
 
 void GXSetTevColor(GXTevRegID id, GXColor color) {
   CHECK(id >= GX_TEVPREV && id < GX_MAX_TEVREG, "bad tevreg {}", static_cast<int>(id));
-  update_gx_state(g_gxState.colorRegs[id], from_gx_color(color));
+  update_gx_state(g_gxState.colorRegs[id], from_gx_color(color), DirtyTevConstants);
 }
 
 void GXSetTevColorS10(GXTevRegID id, GXColorS10 color) {
-  update_gx_state(g_gxState.colorRegs[id], aurora::Vec4<float>{
-                                               static_cast<float>(color.r) / 255.f,
-                                               static_cast<float>(color.g) / 255.f,
-                                               static_cast<float>(color.b) / 255.f,
-                                               static_cast<float>(color.a) / 255.f,
-                                           });
+  update_gx_state(g_gxState.colorRegs[id],
+                  aurora::Vec4<float>{
+                      static_cast<float>(color.r) / 255.f,
+                      static_cast<float>(color.g) / 255.f,
+                      static_cast<float>(color.b) / 255.f,
+                      static_cast<float>(color.a) / 255.f,
+                  },
+                  DirtyTevConstants);
 }
 
 void GXSetAlphaCompare(GXCompare comp0, u8 ref0, GXAlphaOp op, GXCompare comp1, u8 ref1) {
-  update_gx_state(g_gxState.alphaCompare, {comp0, ref0, op, comp1, ref1});
+  update_gx_state(g_gxState.alphaCompare, {comp0, ref0, op, comp1, ref1}, DirtyPipeline);
 }
 
 void GXSetTevOrder(GXTevStageID id, GXTexCoordID tcid, GXTexMapID tmid, GXChannelID cid) {
   auto& stage = g_gxState.tevStages[id];
-  update_gx_state(stage.texCoordId, tcid);
-  update_gx_state(stage.texMapId, tmid);
-  update_gx_state(stage.channelId, cid);
+  update_gx_state(stage.texCoordId, tcid, DirtyPipeline);
+  update_gx_state(stage.texMapId, tmid, DirtyPipeline);
+  update_gx_state(stage.channelId, cid, DirtyPipeline);
 }
 
 // TODO GXSetZTexture
 
-void GXSetNumTevStages(u8 num) { update_gx_state(g_gxState.numTevStages, num); }
+void GXSetNumTevStages(u8 num) { update_gx_state(g_gxState.numTevStages, num, DirtyPipeline); }
 
 void GXSetTevKColor(GXTevKColorID id, GXColor color) {
   CHECK(id >= GX_KCOLOR0 && id < GX_MAX_KCOLOR, "bad kcolor {}", static_cast<int>(id));
-  update_gx_state(g_gxState.kcolors[id], from_gx_color(color));
+  update_gx_state(g_gxState.kcolors[id], from_gx_color(color), DirtyTevConstants);
 }
 
-void GXSetTevKColorSel(GXTevStageID id, GXTevKColorSel sel) { update_gx_state(g_gxState.tevStages[id].kcSel, sel); }
+void GXSetTevKColorSel(GXTevStageID id, GXTevKColorSel sel) {
+  update_gx_state(g_gxState.tevStages[id].kcSel, sel, DirtyPipeline);
+}
 
-void GXSetTevKAlphaSel(GXTevStageID id, GXTevKAlphaSel sel) { update_gx_state(g_gxState.tevStages[id].kaSel, sel); }
+void GXSetTevKAlphaSel(GXTevStageID id, GXTevKAlphaSel sel) {
+  update_gx_state(g_gxState.tevStages[id].kaSel, sel, DirtyPipeline);
+}
 
 void GXSetTevSwapMode(GXTevStageID stageId, GXTevSwapSel rasSel, GXTevSwapSel texSel) {
   auto& stage = g_gxState.tevStages[stageId];
-  update_gx_state(stage.tevSwapRas, rasSel);
-  update_gx_state(stage.tevSwapTex, texSel);
+  update_gx_state(stage.tevSwapRas, rasSel, DirtyPipeline);
+  update_gx_state(stage.tevSwapTex, texSel, DirtyPipeline);
 }
 
 void GXSetTevSwapModeTable(GXTevSwapSel id, GXTevColorChan red, GXTevColorChan green, GXTevColorChan blue,
                            GXTevColorChan alpha) {
   CHECK(id >= GX_TEV_SWAP0 && id < GX_MAX_TEVSWAP, "bad tev swap sel {}", static_cast<int>(id));
-  update_gx_state(g_gxState.tevSwapTable[id], {red, green, blue, alpha});
+  update_gx_state(g_gxState.tevSwapTable[id], {red, green, blue, alpha}, DirtyPipeline);
 }
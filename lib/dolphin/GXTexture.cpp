@@ -121,7 +121,7 @@ void GXLoadTexObj(GXTexObj* obj_, GXTexMapID id) {
     obj->dataInvalidated = false;
   }
   g_gxState.textures[id] = {*obj};
-  g_gxState.stateDirty = true; // TODO only if changed?
+  g_gxState.dirtyState |= DirtyTextures; // TODO only if changed?
 }
 
 u32 GXGetTexBufferSize(u16 width, u16 height, u32 fmt, GXBool mips, u8 maxLod) {
@@ -215,7 +215,7 @@ void GXInitTlutObj(GXTlutObj* obj_, const void* data, GXTlutFmt format, u16 entr
 
 void GXLoadTlut(const GXTlutObj* obj_, GXTlut idx) {
   g_gxState.tluts[idx] = *reinterpret_cast<const GXTlutObj_*>(obj_);
-  // TODO stateDirty?
+  // TODO DirtyTextures?
 }
 
 // TODO GXInitTexCacheRegion
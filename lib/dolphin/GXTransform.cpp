@@ -14,9 +14,9 @@ void GXSetProjection(const void* mtx_, GXProjectionType type) {
   g_gxState.origProj = mtx;
   g_gxState.projType = type;
 #ifdef AURORA_NATIVE_MATRIX
-  update_gx_state(g_gxState.proj, DepthCorrect * mtx);
+  update_gx_state(g_gxState.proj, DepthCorrect * mtx, DirtyMatrices);
 #else
-  update_gx_state(g_gxState.proj, DepthCorrect * mtx.transpose());
+  update_gx_state(g_gxState.proj, DepthCorrect * mtx.transpose(), DirtyMatrices);
 #endif
 }
 
@@ -27,10 +27,10 @@ void GXLoadPosMtxImm(const void* mtx_, u32 id) {
   auto& state = g_gxState.pnMtx[id / 3];
 #ifdef AURORA_NATIVE_MATRIX
   const auto& mtx = *reinterpret_cast<const aurora::Mat4x4<float>*>(mtx_);
-  update_gx_state(state.pos, mtx);
+  update_gx_state(state.pos, mtx, DirtyMatrices);
 #else
   const auto* mtx = reinterpret_cast<const aurora::Mat3x4<float>*>(mtx_);
-  update_gx_state(state.pos, mtx->toTransposed4x4());
+  update_gx_state(state.pos, mtx->toTransposed4x4(), DirtyMatrices);
 #endif
 }
 
@@ -41,10 +41,10 @@ void GXLoadNrmMtxImm(const void* mtx_, u32 id) {
   auto& state = g_gxState.pnMtx[id / 3];
 #ifdef AURORA_NATIVE_MATRIX
   const auto& mtx = *reinterpret_cast<const aurora::Mat4x4<float>*>(mtx_);
-  update_gx_state(state.nrm, mtx);
+  update_gx_state(state.nrm, mtx, DirtyMatrices);
 #else
   const auto* mtx = reinterpret_cast<const aurora::Mat3x4<float>*>(mtx_);
-  update_gx_state(state.nrm, mtx->toTransposed4x4());
+  update_gx_state(state.nrm, mtx->toTransposed4x4(), DirtyMatrices);
 #endif
 }
 
@@ -53,7 +53,7 @@ void GXLoadNrmMtxImm(const void* mtx_, u32 id) {
 
 void GXSetCurrentMtx(u32 id) {
   CHECK(id >= GX_PNMTX0 && id <= GX_PNMTX9, "invalid pn mtx {}", static_cast<int>(id));
-  update_gx_state(g_gxState.currentPnMtx, id / 3);
+  update_gx_state(g_gxState.currentPnMtx, id / 3, DirtyMatrices);
 }
 
 void GXLoadTexMtxImm(const void* mtx_, u32 id, GXTexMtxType type) {
@@ -64,10 +64,10 @@ void GXLoadTexMtxImm(const void* mtx_, u32 id, GXTexMtxType type) {
     const auto idx = (id - GX_PTTEXMTX0) / 3;
 #ifdef AURORA_NATIVE_MATRIX
     const auto& mtx = *reinterpret_cast<const aurora::Mat4x4<float>*>(mtx_);
-    update_gx_state<aurora::Mat4x4<float>>(g_gxState.ptTexMtxs[idx], mtx);
+    update_gx_state<aurora::Mat4x4<float>>(g_gxState.ptTexMtxs[idx], mtx, DirtyMatrices);
 #else
     const auto& mtx = *reinterpret_cast<const aurora::Mat3x4<float>*>(mtx_);
-    update_gx_state<aurora::Mat4x4<float>>(g_gxState.ptTexMtxs[idx], mtx.toTransposed4x4());
+    update_gx_state<aurora::Mat4x4<float>>(g_gxState.ptTexMtxs[idx], mtx.toTransposed4x4(), DirtyMatrices);
 #endif
   } else {
     const auto idx = (id - GX_TEXMTX0) / 3;
@@ -75,19 +75,19 @@ void GXLoadTexMtxImm(const void* mtx_, u32 id, GXTexMtxType type) {
     case GX_MTX3x4: {
 #ifdef AURORA_NATIVE_MATRIX
       const auto& mtx = *reinterpret_cast<const aurora::Mat4x4<float>*>(mtx_);
-      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx);
+      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx, DirtyMatrices);
 #else
       const auto& mtx = *reinterpret_cast<const aurora::Mat3x4<float>*>(mtx_);
-      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx.toTransposed4x4());
+      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx.toTransposed4x4(), DirtyMatrices);
 #endif
       break;
     }
     case GX_MTX2x4: {
       const auto& mtx = *reinterpret_cast<const aurora::Mat4x2<float>*>(mtx_);
 #ifdef AURORA_NATIVE_MATRIX
-      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx);
+      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx, DirtyMatrices);
 #else
-      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx.transpose());
+      update_gx_state<aurora::gfx::gx::TexMtxVariant>(g_gxState.texMtxs[idx], mtx.transpose(), DirtyMatrices);
 #endif
       break;
     }
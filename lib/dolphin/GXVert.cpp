@@ -21,15 +21,13 @@ static inline GXAttr next_attr(size_t begin) {
 struct SStreamState {
   GXPrimitive primitive;
   u16 vertexCount = 0;
-  u16 vertexStart = 0;
   aurora::ByteBuffer vertexBuffer;
   std::vector<u16> indices;
 #ifndef NDEBUG
   GXAttr nextAttr;
 #endif
 
-  explicit SStreamState(GXPrimitive primitive, u16 numVerts, u16 vertexSize, u16 vertexStart) noexcept
-  : primitive(primitive), vertexStart(vertexStart) {
+  explicit SStreamState(GXPrimitive primitive, u16 numVerts, u16 vertexSize) noexcept : primitive(primitive) {
     vertexBuffer.reserve_extra(size_t(numVerts) * vertexSize);
     if (numVerts > 3 && (primitive == GX_TRIANGLEFAN || primitive == GX_TRIANGLESTRIP)) {
       indices.reserve((u32(numVerts) - 3) * 3 + 3);
@@ -45,7 +43,6 @@ struct SStreamState {
 };
 
 static std::optional<SStreamState> sStreamState;
-static u16 lastVertexStart = 0;
 
 void GXBegin(GXPrimitive primitive, GXVtxFmt vtxFmt, u16 nVerts) {
   CHECK(!sStreamState, "Stream began twice!");
@@ -67,7 +64,7 @@ void GXBegin(GXPrimitive primitive, GXVtxFmt vtxFmt, u16 nVerts) {
     attr = GXAttr(attr + 1);
   }
   CHECK(vertexSize > 0, "no vtx attributes enabled?");
-  sStreamState.emplace(primitive, nVerts, vertexSize, g_gxState.stateDirty ? 0 : lastVertexStart);
+  sStreamState.emplace(primitive, nVerts, vertexSize);
 }
 
 static inline void check_attr_order(GXAttr attr) noexcept {
@@ -85,11 +82,11 @@ void GXPosition3f32(float x, float y, float z) {
   state.vertexBuffer.append(&x, sizeof(float));
   state.vertexBuffer.append(&y, sizeof(float));
   state.vertexBuffer.append(&z, sizeof(float));
-  auto curVertex = state.vertexStart + state.vertexCount;
+  auto curVertex = state.vertexCount;
   if (state.primitive == GX_TRIANGLES || state.vertexCount < 3) {
     // pass
   } else if (state.primitive == GX_TRIANGLEFAN) {
-    state.indices.push_back(state.vertexStart);
+    state.indices.push_back(0);
     state.indices.push_back(curVertex - 1);
   } else if (state.primitive == GX_TRIANGLESTRIP) {
     if ((state.vertexCount & 1) == 0) {
@@ -161,27 +158,45 @@ void GXEnd() {
   }
   const auto vertRange = aurora::gfx::push_verts(sStreamState->vertexBuffer.data(), sStreamState->vertexBuffer.size());
   const auto indexRange = aurora::gfx::push_indices(aurora::ArrayRef{sStreamState->indices});
-  if (g_gxState.stateDirty) {
-    aurora::gfx::stream::PipelineConfig config{};
-    populate_pipeline_config(config, GX_TRIANGLES);
-    const auto info = aurora::gfx::gx::build_shader_info(config.shaderConfig);
-    const auto pipeline = aurora::gfx::pipeline_ref(config);
+  if (g_gxState.dirtyState == 0 && aurora::gfx::merge_draw_command(aurora::gfx::stream::DrawData{
+                                       .vertRange = vertRange,
+                                       .indexRange = indexRange,
+                                       .indexCount = static_cast<uint32_t>(sStreamState->indices.size()),
+                                       .vtxCount = sStreamState->vertexCount,
+                                   })) {
+    // Appended to the last draw
+  } else if (const auto* last = aurora::gfx::gx::reusable_draw(aurora::gfx::ShaderType::Stream)) {
+    // Only uniform state changed
+    const auto uniformRanges = aurora::gfx::gx::build_uniform(last->shaderConfig, last->info);
     aurora::gfx::push_draw_command(aurora::gfx::stream::DrawData{
-        .pipeline = pipeline,
+        .pipeline = last->pipeline,
         .vertRange = vertRange,
-        .uniformRange = build_uniform(info),
+        .uniformRanges = uniformRanges,
         .indexRange = indexRange,
         .indexCount = static_cast<uint32_t>(sStreamState->indices.size()),
-        .bindGroups = aurora::gfx::gx::build_bind_groups(info, config.shaderConfig, {}),
+        .bindGroups = aurora::gfx::gx::reuse_bind_groups(uniformRanges),
         .dstAlpha = g_gxState.dstAlpha,
+        .perDrawStorage = last->info.perDrawStorage,
     });
+    g_gxState.dirtyState = 0;
   } else {
-    aurora::gfx::merge_draw_command(aurora::gfx::stream::DrawData{
+    aurora::gfx::stream::PipelineConfig config{};
+    populate_pipeline_config(config, GX_TRIANGLES);
+    auto info = aurora::gfx::gx::build_shader_info(config.shaderConfig);
+    const auto [pipeline, uniformRanges] = aurora::gfx::gx::build_pipeline_uniform(config, info);
+    const auto bindGroups =
+        aurora::gfx::gx::build_bind_groups(info, config.shaderConfig, {}, uniformRanges);
+    aurora::gfx::push_draw_command(aurora::gfx::stream::DrawData{
+        .pipeline = pipeline,
         .vertRange = vertRange,
+        .uniformRanges = uniformRanges,
         .indexRange = indexRange,
         .indexCount = static_cast<uint32_t>(sStreamState->indices.size()),
+        .bindGroups = bindGroups,
+        .dstAlpha = g_gxState.dstAlpha,
+        .perDrawStorage = info.perDrawStorage,
     });
+    aurora::gfx::gx::set_last_draw(aurora::gfx::ShaderType::Stream, pipeline, config, info, bindGroups, uniformRanges);
   }
-  lastVertexStart = sStreamState->vertexStart + sStreamState->vertexCount;
   sStreamState.reset();
 }
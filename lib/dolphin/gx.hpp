@@ -6,12 +6,13 @@
 static aurora::Module Log("aurora::gx");
 
 using aurora::gfx::gx::g_gxState;
+using enum aurora::gfx::gx::DirtyFlag;
 
 template <typename T>
-static inline void update_gx_state(T& val, T newVal) {
+static inline void update_gx_state(T& val, T newVal, aurora::gfx::gx::DirtyFlags dirty) {
   if (val != newVal) {
     val = std::move(newVal);
-    g_gxState.stateDirty = true;
+    g_gxState.dirtyState |= dirty;
   }
 }
 
@@ -3,15 +3,23 @@
 #include "../internal.hpp"
 #include "../webgpu/gpu.hpp"
 #include "model/shader.hpp"
+#include "pipeline_cache.hpp"
 #include "stream/shader.hpp"
 #include "texture.hpp"
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <filesystem>
 #include <fstream>
+#include <map>
 #include <thread>
 #include <mutex>
+#include <numeric>
+#include <optional>
 #include <magic_enum.hpp>
 
 namespace aurora::gfx {
@@ -23,66 +31,98 @@ using webgpu::g_queue;
 
 #ifdef AURORA_GFX_DEBUG_GROUPS
 std::vector<std::string> g_debugGroupStack;
+static bool g_debugGroupsChanged = false;
 #endif
 
+// Default initial chunk sizes, see AuroraConfig
 constexpr uint64_t UniformBufferSize = 3145728;  // 3mb
 constexpr uint64_t VertexBufferSize = 3145728;   // 3mb
 constexpr uint64_t IndexBufferSize = 1048576;    // 1mb
 constexpr uint64_t StorageBufferSize = 8388608;  // 8mb
 constexpr uint64_t TextureUploadSize = 25165824; // 24mb
 
-constexpr uint64_t StagingBufferSize =
-    UniformBufferSize + VertexBufferSize + IndexBufferSize + StorageBufferSize + TextureUploadSize;
+// Staging buffers per ring chunk, see AuroraConfig::framesInFlight. At least 2: end_frame maps the next frame's
+// staging buffers before this frame's copies out of its own are submitted.
+constexpr size_t MinFramesInFlight = 2;
+constexpr size_t MaxFramesInFlight = 4;
+constexpr size_t DefaultFramesInFlight = 3;
+// Frames between checks whether a buffer ring can shrink
+constexpr u32 BufferShrinkInterval = 600;
+// WebGPU's default maxBufferSize
+constexpr uint64_t MaxBufferChunkSize = 268435456; // 256mb
+constexpr uint64_t MinBufferChunkSize = 65536;     // 64kb
+// Resident vertex arrays, display lists & uniform blocks, see push_vertex_array, push_display_list &
+// push_draw_uniforms
+constexpr uint64_t ResidentBlockSize = 8388608;        // 8mb
+constexpr uint64_t ResidentUniformBlockSize = 1048576; // 1mb
+constexpr u32 ResidentChunkFlag = 0x80000000;          // Range::chunk of a resident block
+constexpr u32 ResidentLifetime = 300;                  // Frames unused before an entry's memory is reused
+constexpr u32 ResidentEvictInterval = 60;
+constexpr uint64_t DisplayListBudget = 67108864; // 64mb, see AuroraConfig::displayListCacheSize
+// Cached bind groups kept across frames, see AuroraConfig::bindGroupCacheSize
+constexpr size_t DefaultBindGroupCacheSize = 4096;
+// Per-ring high-water marks of the last session, sizing the next session's buffers
+constexpr uint32_t BufferSizesMagic = 0x5A534241; // ABSZ
+constexpr uint32_t BufferSizesVersion = 1;
 
 struct ShaderState {
   stream::State stream;
   model::State model;
 };
-struct ShaderDrawCommand {
-  ShaderType type;
-  union {
-    stream::DrawData stream;
-    model::DrawData model;
-  };
-};
-enum class CommandType {
+enum class CommandType : u8 {
   SetViewport,
   SetScissor,
   Draw,
+  PushDebugGroup,
+  PopDebugGroup,
 };
-struct Command {
+// Commands are recorded into a per-frame arena as variable-length packets: a header followed by the payload.
+// Payload sizes are multiples of 4, so every packet stays 4-byte aligned.
+struct CommandHeader {
   CommandType type;
-#ifdef AURORA_GFX_DEBUG_GROUPS
-  std::vector<std::string> debugGroupStack;
-#endif
-  union Data {
-    struct SetViewportCommand {
-      float left;
-      float top;
-      float width;
-      float height;
-      float znear;
-      float zfar;
-
-      bool operator==(const SetViewportCommand& rhs) const {
-        return left == rhs.left && top == rhs.top && width == rhs.width && height == rhs.height && znear == rhs.znear &&
-               zfar == rhs.zfar;
-      }
-      bool operator!=(const SetViewportCommand& rhs) const { return !(*this == rhs); }
-    } setViewport;
-    struct SetScissorCommand {
-      uint32_t x;
-      uint32_t y;
-      uint32_t w;
-      uint32_t h;
-
-      bool operator==(const SetScissorCommand& rhs) const {
-        return x == rhs.x && y == rhs.y && w == rhs.w && h == rhs.h;
-      }
-      bool operator!=(const SetScissorCommand& rhs) const { return !(*this == rhs); }
-    } setScissor;
-    ShaderDrawCommand draw;
-  } data;
+  u8 shaderType; // Draw only
+  u16 size;      // Including the header
+};
+static_assert(sizeof(CommandHeader) == 4);
+struct SetViewportCommand {
+  float left;
+  float top;
+  float width;
+  float height;
+  float znear;
+  float zfar;
+
+  bool operator==(const SetViewportCommand& rhs) const {
+    return left == rhs.left && top == rhs.top && width == rhs.width && height == rhs.height && znear == rhs.znear &&
+           zfar == rhs.zfar;
+  }
+  bool operator!=(const SetViewportCommand& rhs) const { return !(*this == rhs); }
+};
+struct SetScissorCommand {
+  uint32_t x;
+  uint32_t y;
+  uint32_t w;
+  uint32_t h;
+
+  bool operator==(const SetScissorCommand& rhs) const { return x == rhs.x && y == rhs.y && w == rhs.w && h == rhs.h; }
+  bool operator!=(const SetScissorCommand& rhs) const { return !(*this == rhs); }
+};
+// pipeline & bindGroups index the frame's tables. Followed by storageOffsetCount dynamic storage offsets.
+struct DrawPacket {
+  u32 pipeline;
+  u32 bindGroups;
+  Range vertRange;
+  Range indexRange;
+  UniformRanges uniformRanges;
+  u32 indexCount;
+  u32 dstAlpha;
+  u8 storageOffsetCount;
+  u8 opaqueState;   // See gx::opaque_draw_state
+  bool wideIndices; // Uint32 indices, see append_draw_indices
+  bool perDrawStorage;
+};
+struct DebugGroupPacket {
+  u32 label;
 };
 } // namespace aurora::gfx
 
@@ -107,171 +147,643 @@ inline HashType xxh3_hash(const wgpu::SamplerDescriptor& input, HashType seed) {
 
 namespace aurora::gfx {
 using NewPipelineCallback = std::function<wgpu::RenderPipeline()>;
+enum class PipelinePriority : u8 {
+  Frame,      // Requested by a draw in the current frame
+  Precompile, // Requested by aurora_precompile_tag
+  Replay,     // Loaded from pipeline_cache.bin
+};
+constexpr size_t PipelinePriorityCount = 3;
+struct QueuedPipeline {
+  NewPipelineCallback cb; // Moved out once a worker starts building it
+  PipelinePriority priority;
+};
 std::mutex g_pipelineMutex;
 static bool g_hasPipelineThread = false;
 static size_t g_pipelinesPerFrame = 0;
-#ifdef NDEBUG
-constexpr size_t BuildPipelinesPerFrame = 5;
-#else
-constexpr size_t BuildPipelinesPerFrame = 1;
-#endif
-static std::thread g_pipelineThread;
+static std::chrono::steady_clock::duration g_pipelineTimePerFrame;
+static std::vector<std::thread> g_pipelineThreads;
 static std::atomic_bool g_pipelineThreadEnd;
 static std::condition_variable g_pipelineCv;
-static absl::flat_hash_map<PipelineRef, wgpu::RenderPipeline> g_pipelines;
-static std::deque<std::pair<PipelineRef, NewPipelineCallback>> g_queuedPipelines;
-static absl::flat_hash_map<BindGroupRef, wgpu::BindGroup> g_cachedBindGroups;
+using PipelineMap = absl::flat_hash_map<PipelineRef, wgpu::RenderPipeline>;
+// Only accessed from the main thread, so lookups don't lock
+static PipelineMap g_pipelines;
+// Built by workers (or queued builds), moved into g_pipelines in batches by publish_pipelines. Requires
+// g_pipelineMutex.
+static PipelineMap g_builtPipelines;
+// Pending until published; queues may hold stale refs after a promotion, which are skipped
+static absl::flat_hash_map<PipelineRef, QueuedPipeline> g_queuedPipelines;
+static std::array<std::deque<PipelineRef>, PipelinePriorityCount> g_pipelineQueues;
+struct CachedBindGroup {
+  wgpu::BindGroup bindGroup;
+  u32 lastUsedFrame;
+  std::vector<WGPUTextureView> textureViews; // Entry is dropped once any of these is released
+};
+static absl::flat_hash_map<BindGroupRef, CachedBindGroup> g_cachedBindGroups;
+static absl::flat_hash_set<WGPUTextureView> g_releasedTextureViews;
+static size_t g_bindGroupCacheSize = DefaultBindGroupCacheSize;
+static bool g_bindGroupCacheActive = false; // Textures may outlive gfx shutdown
 static absl::flat_hash_map<SamplerRef, wgpu::Sampler> g_cachedSamplers;
 std::atomic_uint32_t queuedPipelines;
 std::atomic_uint32_t createdPipelines;
+// Time until the pipeline_cache.bin replay is fully built, to compare cold & warm (blob cache) startups
+static std::chrono::steady_clock::time_point g_replayStart;
+static bool g_replayPending = false;
 
-static ByteBuffer g_verts;
-static ByteBuffer g_uniforms;
-static ByteBuffer g_indices;
-static ByteBuffer g_storage;
-static ByteBuffer g_textureUpload;
-wgpu::Buffer g_vertexBuffer;
-wgpu::Buffer g_uniformBuffer;
-wgpu::Buffer g_indexBuffer;
-wgpu::Buffer g_storageBuffer;
-static std::array<wgpu::Buffer, 3> g_stagingBuffers;
 static wgpu::SupportedLimits g_cachedLimits;
 
+// Per-frame upload arenas. Each is a list of chunks, each chunk a GPU buffer (none for texture uploads, which copy
+// straight from staging) with a staging buffer per frame in flight. Pushes fill the current chunk's mapped staging
+// buffer and move on to another chunk once it's full; ranges record which chunk holds them.
+struct BufferChunk {
+  wgpu::Buffer buffer;
+  std::array<wgpu::Buffer, MaxFramesInFlight> staging;
+  uint64_t size = 0;
+  ByteBuffer data; // Mapped range of this frame's staging buffer
+};
+struct BufferRing {
+  const char* label;
+  wgpu::BufferUsage usage;
+  uint64_t initialSize = 0;
+  uint64_t chunkSize = 0;
+  uint64_t pendingChunkSize = 0; // Applied after rendering
+  uint64_t maxChunkSize = MaxBufferChunkSize;
+  std::vector<BufferChunk> chunks;
+  u32 current = 0;
+  uint64_t used = 0;      // This frame, across chunks
+  uint64_t lastUsed = 0;  // Last finished frame
+  uint64_t highWater = 0; // Since the last shrink check
+  uint64_t sessionHighWater = 0;
+  uint64_t persistedHighWater = UINT64_MAX; // From buffer_sizes.bin, UINT64_MAX if none
+  bool spilled = false;                     // This frame needed more than one chunk
+};
+static BufferRing g_vertexRing{"Vertex", wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst};
+static BufferRing g_uniformRing{"Uniform", wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst};
+static BufferRing g_indexRing{"Index", wgpu::BufferUsage::Index | wgpu::BufferUsage::CopyDst};
+static BufferRing g_storageRing{"Storage", wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst};
+static BufferRing g_textureUploadRing{"Texture Upload", wgpu::BufferUsage::None};
+// In AuroraBufferCategory order
+static constexpr std::array g_bufferRings{&g_vertexRing, &g_uniformRing, &g_indexRing, &g_storageRing,
+                                          &g_textureUploadRing};
+static_assert(g_bufferRings.size() == BUFFER_CATEGORY_COUNT);
+static size_t currentStagingBuffer = 0;
+static size_t g_framesInFlight = DefaultFramesInFlight;
+static u32 g_pendingMaps = 0;
+// Set while frame_ready is waiting for the next frame's staging buffers
+static std::optional<std::chrono::steady_clock::time_point> g_gpuWaitStart;
+static std::chrono::nanoseconds g_lastGpuWaitTime{};
+static u32 g_frameIndex = 0;
+
+// Long-lived buffers holding data that doesn't change between frames, sub-allocated first-fit. Released blocks
+// leave an empty slot so block indices stay valid.
+struct ResidentBlock {
+  wgpu::Buffer buffer;
+  uint64_t size = 0;
+  std::map<uint64_t, uint64_t> free; // Offset -> size, coalesced
+};
+struct ResidentPool {
+  const char* label;
+  wgpu::BufferUsage usage;
+  uint64_t alignment = 4; // Of offsets
+  uint64_t blockSize = ResidentBlockSize;
+  uint64_t maxBlockSize = MaxBufferChunkSize;
+  std::vector<ResidentBlock> blocks;
+  uint64_t used = 0;
+};
+static ResidentPool g_residentArrayPool{"Vertex Array", wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst};
+static ResidentPool g_residentVertexPool{"Vertex", wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst};
+static ResidentPool g_residentIndexPool{"Index", wgpu::BufferUsage::Index | wgpu::BufferUsage::CopyDst};
+static ResidentPool g_residentUniformPool{"Uniform", wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst};
+struct ResidentRange {
+  Range range;
+  u32 lastUsedFrame;
+};
+static absl::flat_hash_map<HashType, ResidentRange> g_residentArrays;
+struct ResidentDisplayList {
+  Range vertRange;   // Allocated
+  Range vertBinding; // From the start of its run, drawn with u32 indices rebased onto it
+  Range idxRange;
+  u32 lastUsedFrame;
+};
+static absl::flat_hash_map<HashType, ResidentDisplayList> g_residentDisplayLists;
+// Vertex binding of display lists uploaded back to back with the same stride, so that their draws merge
+struct DisplayListRun {
+  Range binding;
+  u32 stride = 0;
+};
+static DisplayListRun g_displayListRun;
+static uint64_t g_displayListBudget = DisplayListBudget;
+
+static bool is_resident(const Range& range) { return (range.chunk & ResidentChunkFlag) != 0; }
+static const wgpu::Buffer& resident_buffer(const ResidentPool& pool, u32 chunk) {
+  return pool.blocks[chunk & ~ResidentChunkFlag].buffer;
+}
+
+static wgpu::Buffer create_buffer(wgpu::BufferUsage usage, uint64_t size, const std::string& label,
+                                  bool mappedAtCreation = false) {
+  const wgpu::BufferDescriptor descriptor{
+      .label = label.c_str(),
+      .usage = usage,
+      .size = size,
+      .mappedAtCreation = mappedAtCreation,
+  };
+  return g_device.CreateBuffer(&descriptor);
+}
+
+static u32 add_buffer_chunk(BufferRing& ring, uint64_t size) {
+  const u32 idx = ring.chunks.size();
+  auto& chunk = ring.chunks.emplace_back();
+  chunk.size = size;
+  if (ring.usage != wgpu::BufferUsage::None) {
+    chunk.buffer = create_buffer(ring.usage, size, fmt::format(FMT_STRING("Shared {} Buffer {}"), ring.label, idx));
+  }
+  return idx;
+}
+
+// Maps the chunk's staging buffer for this frame, creating it mapped if it doesn't exist yet
+static void begin_buffer_chunk(const BufferRing& ring, BufferChunk& chunk) {
+  auto& staging = chunk.staging[currentStagingBuffer];
+  if (!staging) {
+    staging = create_buffer(wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc, chunk.size,
+                            fmt::format(FMT_STRING("{} Staging Buffer {}"), ring.label, currentStagingBuffer), true);
+  }
+  chunk.data = ByteBuffer{static_cast<u8*>(staging.GetMappedRange(0, chunk.size)), static_cast<size_t>(chunk.size)};
+}
+
+// Returns the chunk to write size bytes to, moving on to a free chunk (or a new one) once the current one is full
+static u32 reserve_buffer_chunk(BufferRing& ring, uint64_t size) {
+  if (ring.current < ring.chunks.size()) {
+    const auto& chunk = ring.chunks[ring.current];
+    if (chunk.data.size() + size <= chunk.size) {
+      return ring.current;
+    }
+  }
+  if (!ring.chunks.empty()) {
+    ring.spilled = true;
+  }
+  for (u32 i = 0; i < ring.chunks.size(); ++i) {
+    const auto& chunk = ring.chunks[i];
+    if (chunk.data.empty() && size <= chunk.size) {
+      ring.current = i;
+      return i;
+    }
+  }
+  const u32 idx = add_buffer_chunk(ring, std::max(ring.chunkSize, ALIGN(size, 4)));
+  begin_buffer_chunk(ring, ring.chunks[idx]);
+  ring.current = idx;
+  return idx;
+}
+
+static u8* buffer_data(BufferRing& ring, const Range& range) {
+  return ring.chunks[range.chunk].data.data() + range.offset;
+}
+
+// Chunk sizes follow the high-water mark: a frame that spilled into another chunk grows the ring to fit in one,
+// and a ring that stayed well below its chunk size for BufferShrinkInterval frames shrinks back towards its
+// initial size. Applied by resize_buffer_rings once the frame is rendered.
+static void update_buffer_ring_size(BufferRing& ring) {
+  ring.lastUsed = ring.used;
+  ring.highWater = std::max(ring.highWater, ring.used);
+  ring.sessionHighWater = std::max(ring.sessionHighWater, ring.used);
+  if (ring.spilled) {
+    const auto size =
+        std::min(ALIGN(std::max(ring.used, ring.chunkSize) / 4 * 5, 4), ring.maxChunkSize);
+    if (size > ring.chunkSize) {
+      ring.pendingChunkSize = size;
+    }
+  } else if (g_frameIndex % BufferShrinkInterval == 0) {
+    if (ring.highWater < ring.chunkSize / 4 && ring.chunkSize > ring.initialSize) {
+      ring.pendingChunkSize = std::max(ring.initialSize, ALIGN(ring.highWater * 2, 4));
+    }
+    ring.highWater = 0;
+  }
+}
+
+static void resize_buffer_rings() {
+  bool resized = false;
+  for (auto* ring : g_bufferRings) {
+    if (ring->pendingChunkSize == 0) {
+      continue;
+    }
+    Log.report(LOG_INFO, FMT_STRING("Resizing {} buffer chunks from {} KiB to {} KiB ({} chunks, {} KiB used)"),
+               ring->label, ring->chunkSize / 1024, ring->pendingChunkSize / 1024, ring->chunks.size(),
+               ring->used / 1024);
+    for (auto& chunk : ring->chunks) {
+      // Pending map for the next frame; unlike the others, it isn't used by this frame's commands
+      if (auto& staging = chunk.staging[currentStagingBuffer]) {
+        staging.Destroy();
+      }
+    }
+    ring->chunks.clear();
+    ring->current = 0;
+    ring->chunkSize = ring->pendingChunkSize;
+    ring->pendingChunkSize = 0;
+    ring->highWater = 0;
+    if (ring->usage != wgpu::BufferUsage::None) {
+      add_buffer_chunk(*ring, ring->chunkSize);
+    }
+    resized = true;
+  }
+  if (resized) {
+    // These reference the replaced buffers
+    g_cachedBindGroups.clear();
+    gx::g_lastDraw.reset();
+  }
+}
+
+struct BufferSizesFile {
+  uint32_t magic = BufferSizesMagic;
+  uint32_t version = BufferSizesVersion;
+  std::array<uint64_t, BUFFER_CATEGORY_COUNT> highWater{};
+};
+
+static std::filesystem::path buffer_sizes_path() {
+  return std::filesystem::path{g_config.configPath} / "buffer_sizes.bin";
+}
+
+static void load_buffer_sizes() {
+  BufferSizesFile file{};
+  std::ifstream in{buffer_sizes_path(), std::ios::binary};
+  if (!in.read(reinterpret_cast<char*>(&file), sizeof(file)) || file.magic != BufferSizesMagic ||
+      file.version != BufferSizesVersion) {
+    return;
+  }
+  for (size_t i = 0; i < g_bufferRings.size(); ++i) {
+    g_bufferRings[i]->persistedHighWater = file.highWater[i];
+  }
+}
+
+static void save_buffer_sizes() {
+  BufferSizesFile file{};
+  for (size_t i = 0; i < g_bufferRings.size(); ++i) {
+    const auto& ring = *g_bufferRings[i];
+    file.highWater[i] = ring.sessionHighWater;
+    if (g_frameIndex < BufferShrinkInterval && ring.persistedHighWater != UINT64_MAX) {
+      // Too short to be representative, e.g. quit from the menu
+      file.highWater[i] = std::max(file.highWater[i], ring.persistedHighWater);
+    }
+  }
+  std::ofstream out{buffer_sizes_path(), std::ios::binary | std::ios::trunc};
+  if (!out.write(reinterpret_cast<const char*>(&file), sizeof(file))) {
+    Log.report(LOG_WARNING, FMT_STRING("Failed to write {}"), buffer_sizes_path().string());
+  }
+}
+
+// AuroraConfig override, else the last session's high-water mark with headroom, else the default
+static uint64_t initial_buffer_size(const BufferRing& ring, uint32_t configured, uint64_t fallback) {
+  if (configured != 0) {
+    return std::min(ALIGN(uint64_t{configured}, 4), ring.maxChunkSize);
+  }
+  if (ring.persistedHighWater != UINT64_MAX) {
+    return std::clamp(ALIGN(ring.persistedHighWater / 4 * 5, 4), MinBufferChunkSize, ring.maxChunkSize);
+  }
+  return fallback;
+}
+
+const wgpu::Buffer& uniform_buffer(uint32_t chunk) {
+  if ((chunk & ResidentChunkFlag) != 0) {
+    return resident_buffer(g_residentUniformPool, chunk);
+  }
+  return g_uniformRing.chunks[chunk].buffer;
+}
+const wgpu::Buffer& storage_buffer(uint32_t chunk) {
+  if ((chunk & ResidentChunkFlag) != 0) {
+    return resident_buffer(g_residentArrayPool, chunk);
+  }
+  return g_storageRing.chunks[chunk].buffer;
+}
+
 static ShaderState g_state;
-static PipelineRef g_currentPipeline;
+// Encoder state of the render pass being replayed, so unchanged state isn't set again
+constexpr size_t MaxBindGroups = 3;
+constexpr size_t MaxDynamicOffsets = gx::MaxUniformBlocks + GX_VA_MAX_ATTR;
+struct BoundBindGroup {
+  BindGroupRef id = 0;
+  u32 offsetCount = 0;
+  std::array<u32, MaxDynamicOffsets> offsets;
+};
+struct PassState {
+  PipelineRef pipeline = UINTPTR_MAX;
+  std::array<BoundBindGroup, MaxBindGroups> bindGroups{};
+  Range vertexBuffer{UINT32_MAX, UINT32_MAX};
+  Range indexBuffer{UINT32_MAX, UINT32_MAX};
+  wgpu::IndexFormat indexFormat = wgpu::IndexFormat::Undefined;
+  std::optional<wgpu::Color> blendConstant;
+};
+static PassState g_passState;
 
 // for imgui debug
 size_t g_drawCallCount;
 size_t g_mergedDrawCallCount;
+size_t g_dedupedUniformSize;
+size_t g_bindGroupHits;
+size_t g_bindGroupMisses;
+size_t g_bindGroupEvictions;
+size_t g_residentArraySize;
+size_t g_residentUniformSize;
+size_t g_residentDisplayListSize;
+size_t g_residentUploadSize;
 size_t g_lastVertSize;
 size_t g_lastUniformSize;
 size_t g_lastIndexSize;
 size_t g_lastStorageSize;
+size_t g_stateCallCount;
+size_t g_skippedStateCallCount;
 
-using CommandList = std::vector<Command>;
 struct RenderPass {
   TextureHandle resolveTarget;
   ClipRect resolveRect;
   Vec4<float> clearColor{0.f, 0.f, 0.f, 0.f};
-  CommandList commands;
+  // Range of g_commands
+  size_t commandsBegin = 0;
+  size_t commandsEnd = 0;
   bool clear = true;
 };
 static std::vector<RenderPass> g_renderPasses;
 static u32 g_currentRenderPass = UINT32_MAX;
+// Per-frame command arena & the tables its draw packets index. Cleared after rendering, keeping their capacity.
+static std::vector<u8> g_commands; // Grown only, g_commandsSize is in use
+static size_t g_commandsSize = 0;
+static size_t g_lastCommand = SIZE_MAX;
+static std::vector<PipelineRef> g_drawPipelines;
+static std::vector<gx::GXBindGroups> g_drawBindGroups;
+// Uniform blocks pushed this & last frame, by content hash. Frame & material blocks seen in both become resident.
+static absl::flat_hash_map<HashType, Range> g_drawUniforms;
+static absl::flat_hash_map<HashType, Range> g_lastDrawUniforms;
+static absl::flat_hash_map<HashType, ResidentRange> g_residentUniforms;
+// Offsets of a pass' commands in replay order, when sorting opaque draws
+static std::vector<u32> g_commandOrder;
+#ifdef AURORA_GFX_DEBUG_GROUPS
+static std::vector<std::string> g_debugLabels;
+// Groups open at the end of the current pass' commands
+static std::vector<std::string> g_recordedDebugGroups;
+#endif
 std::vector<TextureUpload> g_textureUploads;
 
-static ByteBuffer g_serializedPipelines{};
-static u32 g_serializedPipelineCount = 0;
+// Main thread only
+static void publish_pipelines() {
+  std::scoped_lock guard{g_pipelineMutex};
+  for (auto& [ref, pipeline] : g_builtPipelines) {
+    ASSERT(g_pipelines.try_emplace(ref, std::move(pipeline)).second, "Duplicate pipeline {}", ref);
+  }
+  g_builtPipelines.clear();
+}
+
+// Synchronous builds are allowed at least once per frame, then until the budget runs out
+static bool has_pipeline_budget() {
+  return g_pipelinesPerFrame == 0 || g_pipelineTimePerFrame < std::chrono::milliseconds{g_config.pipelineBudgetMs};
+}
 
-template <typename PipelineConfig>
-static void serialize_pipeline_config(ShaderType type, const PipelineConfig& config) {
-  static_assert(std::has_unique_object_representations_v<PipelineConfig>);
-  g_serializedPipelines.append(&type, sizeof(type));
-  const u32 configSize = sizeof(config);
-  g_serializedPipelines.append(&configSize, sizeof(configSize));
-  g_serializedPipelines.append(&config, configSize);
-  ++g_serializedPipelineCount;
+static wgpu::RenderPipeline build_pipeline_sync(const NewPipelineCallback& cb) {
+  const auto start = std::chrono::steady_clock::now();
+  auto result = cb();
+  g_pipelineTimePerFrame += std::chrono::steady_clock::now() - start;
+  ++g_pipelinesPerFrame;
+  return result;
 }
 
-template <typename PipelineConfig>
-static PipelineRef find_pipeline(ShaderType type, const PipelineConfig& config, NewPipelineCallback&& cb,
-                                 bool serialize = true) {
-  PipelineRef hash = xxh3_hash(config, static_cast<HashType>(type));
-  bool found = false;
+static PipelineRef find_pipeline(ShaderType type, const gx::PipelineKey& key, NewPipelineCallback&& cb,
+                                 PipelinePriority priority = PipelinePriority::Frame) {
+  PipelineRef hash = xxh3_hash(key, static_cast<HashType>(type));
+  if (priority == PipelinePriority::Frame) {
+    pipeline_cache::record_use(type, hash, &key, sizeof(key), g_frameIndex);
+  }
+  if (g_pipelines.contains(hash)) {
+    return hash;
+  }
+  bool queued = false;
   {
     std::scoped_lock guard{g_pipelineMutex};
-    found = g_pipelines.contains(hash);
-    if (!found) {
-      const auto ref =
-          std::find_if(g_queuedPipelines.begin(), g_queuedPipelines.end(), [=](auto v) { return v.first == hash; });
-      if (g_hasPipelineThread) {
-        if (ref != g_queuedPipelines.end()) {
-          found = true;
-        }
-      } else {
-        if (ref != g_queuedPipelines.end()) {
-          found = true;
-        } else if (g_pipelinesPerFrame < BuildPipelinesPerFrame) {
-          g_pipelines.try_emplace(hash, cb());
-          if (serialize) {
-            serialize_pipeline_config(type, config);
-          }
-          ++g_pipelinesPerFrame;
-          createdPipelines++;
-          found = true;
-        }
-      }
+    if (g_builtPipelines.contains(hash)) {
+      return hash;
     }
-    if (!found) {
-      g_queuedPipelines.emplace_back(std::pair{hash, std::move(cb)});
-      if (serialize) {
-        serialize_pipeline_config(type, config);
+    const auto it = g_queuedPipelines.find(hash);
+    if (it != g_queuedPipelines.end()) {
+      if (priority < it->second.priority && it->second.cb) {
+        // Promote; the old queue entry becomes stale
+        it->second.priority = priority;
+        g_pipelineQueues[static_cast<size_t>(priority)].push_back(hash);
+        queued = true;
       }
+    } else if (!g_hasPipelineThread && priority == PipelinePriority::Frame && has_pipeline_budget()) {
+      g_pipelines.try_emplace(hash, build_pipeline_sync(cb));
+      createdPipelines++;
+    } else {
+      g_queuedPipelines.try_emplace(hash, QueuedPipeline{std::move(cb), priority});
+      g_pipelineQueues[static_cast<size_t>(priority)].push_back(hash);
+      queuedPipelines++;
+      queued = true;
     }
   }
-  if (!found) {
+  if (queued) {
     g_pipelineCv.notify_one();
-    queuedPipelines++;
   }
   return hash;
 }
 
-static inline void push_command(CommandType type, const Command::Data& data) {
+constexpr size_t CommandArenaInitialSize = 262144; // 256kb
+static u8* push_packet(CommandType type, size_t payloadSize, u8 shaderType = 0) {
+  const size_t size = sizeof(CommandHeader) + payloadSize;
+  const size_t offset = g_commandsSize;
+  if (offset + size > g_commands.size())
+    UNLIKELY {
+      g_commands.resize(std::max(g_commands.size() * 2, CommandArenaInitialSize));
+    }
+  g_commandsSize += size;
+  const CommandHeader header{type, shaderType, static_cast<u16>(size)};
+  memcpy(g_commands.data() + offset, &header, sizeof(header));
+  g_lastCommand = offset;
+  return g_commands.data() + offset + sizeof(header);
+}
+
+#ifdef AURORA_GFX_DEBUG_GROUPS
+// Records push & pop packets so the pass' open groups match g_debugGroupStack
+static void sync_debug_groups() {
+  if (!g_debugGroupsChanged) {
+    return;
+  }
+  g_debugGroupsChanged = false;
+  size_t firstDiff = 0;
+  while (firstDiff < g_recordedDebugGroups.size() && firstDiff < g_debugGroupStack.size() &&
+         g_recordedDebugGroups[firstDiff] == g_debugGroupStack[firstDiff]) {
+    ++firstDiff;
+  }
+  for (size_t i = firstDiff; i < g_recordedDebugGroups.size(); ++i) {
+    push_packet(CommandType::PopDebugGroup, 0);
+  }
+  g_recordedDebugGroups.resize(firstDiff);
+  for (size_t i = firstDiff; i < g_debugGroupStack.size(); ++i) {
+    const DebugGroupPacket packet{static_cast<u32>(g_debugLabels.size())};
+    g_debugLabels.push_back(g_debugGroupStack[i]);
+    memcpy(push_packet(CommandType::PushDebugGroup, sizeof(packet)), &packet, sizeof(packet));
+    g_recordedDebugGroups.push_back(g_debugGroupStack[i]);
+  }
+}
+#endif
+
+static inline u8* push_command(CommandType type, size_t payloadSize, u8 shaderType = 0) {
   if (g_currentRenderPass == UINT32_MAX)
     UNLIKELY {
       Log.report(LOG_WARNING, FMT_STRING("Dropping command {}"), magic_enum::enum_name(type));
-      return;
+      return nullptr;
     }
-  g_renderPasses[g_currentRenderPass].commands.push_back({
-      .type = type,
 #ifdef AURORA_GFX_DEBUG_GROUPS
-      .debugGroupStack = g_debugGroupStack,
+  sync_debug_groups();
 #endif
-      .data = data,
-  });
+  return push_packet(type, payloadSize, shaderType);
 }
-static inline Command& get_last_draw_command(ShaderType type) {
-  CHECK(g_currentRenderPass != UINT32_MAX, "No last command");
-  auto& last = g_renderPasses[g_currentRenderPass].commands.back();
-  if (last.type != CommandType::Draw || last.data.draw.type != type)
-    UNLIKELY {
-      FATAL("Last command invalid: {} {}, expected {} {}", magic_enum::enum_name(last.type),
-            magic_enum::enum_name(last.data.draw.type), magic_enum::enum_name(CommandType::Draw),
-            magic_enum::enum_name(type));
+template <typename T>
+static inline void push_command(CommandType type, const T& payload) {
+  if (auto* ptr = push_command(type, sizeof(T))) {
+    memcpy(ptr, &payload, sizeof(T));
+  }
+}
+// The last recorded command if it's a draw of the given type
+static inline DrawPacket* get_last_draw_command(ShaderType type) {
+  if (g_currentRenderPass == UINT32_MAX || g_lastCommand == SIZE_MAX) {
+    return nullptr;
+  }
+  CommandHeader header;
+  memcpy(&header, g_commands.data() + g_lastCommand, sizeof(header));
+  if (header.type != CommandType::Draw || header.shaderType != static_cast<u8>(type)) {
+    return nullptr;
+  }
+  return reinterpret_cast<DrawPacket*>(g_commands.data() + g_lastCommand + sizeof(header));
+}
+
+// Grows range, the last push to the ring, by size bytes in place
+static bool extend_last_push(BufferRing& ring, const Range& range, size_t size) {
+  auto& chunk = ring.chunks[range.chunk];
+  if (range.chunk != ring.current || range.offset + range.size != chunk.data.size() ||
+      chunk.data.size() + size > chunk.size) {
+    return false;
+  }
+  chunk.data.append_zeroes(size);
+  ring.used += size;
+  return true;
+}
+
+// Appends a draw's u16 indices, pushed right after the last draw's, to the last draw, adding the draw's first
+// vertex within the last draw's vertex range. Once the merged indices no longer fit in u16, they're widened to u32
+// in place, so merged batches aren't capped at 65536 vertices.
+static bool append_draw_indices(DrawPacket& last, const Range& idxRange, u32 indexCount, u32 baseVertex,
+                                u32 vtxCount) {
+  // Resident indices can't be rebased in place
+  if (is_resident(idxRange) || last.indexRange.chunk != idxRange.chunk ||
+      last.indexRange.offset + last.indexRange.size != idxRange.offset) {
+    return false;
+  }
+  if (!last.wideIndices && baseVertex + vtxCount <= UINT16_MAX + 1) {
+    auto* indices = reinterpret_cast<u16*>(buffer_data(g_indexRing, idxRange));
+    for (u32 i = 0; i < indexCount; ++i) {
+      indices[i] += baseVertex;
     }
-  return last;
+    last.indexRange.size += idxRange.size;
+    last.indexCount += indexCount;
+    return true;
+  }
+  // Widen the new indices, plus the last draw's on the first overflow. u32 index buffers need 4-byte offsets.
+  const u32 srcOffset = last.wideIndices ? idxRange.offset : last.indexRange.offset;
+  const u32 dstOffset = ALIGN(srcOffset, 4);
+  const u32 count = last.wideIndices ? indexCount : last.indexCount + indexCount;
+  const u32 firstRebased = count - indexCount;
+  const u32 wideSize = dstOffset + count * 4 - (idxRange.offset + idxRange.size);
+  if (!extend_last_push(g_indexRing, idxRange, wideSize)) {
+    return false;
+  }
+  // Back to front: u32 i only overlaps u16 i * 2 onwards (shifted by up to one), which were already read
+  u8* chunk = g_indexRing.chunks[idxRange.chunk].data.data();
+  for (u32 i = count; i-- > 0;) {
+    u16 narrow;
+    memcpy(&narrow, chunk + srcOffset + i * 2, sizeof(narrow));
+    const u32 wide = i >= firstRebased ? narrow + baseVertex : narrow;
+    memcpy(chunk + dstOffset + i * 4, &wide, sizeof(wide));
+  }
+  if (!last.wideIndices) {
+    last.indexRange.offset = dstOffset;
+    last.wideIndices = true;
+  }
+  last.indexCount += indexCount;
+  last.indexRange.size = last.indexCount * 4;
+  return true;
+}
+
+// The draw's first vertex within the last draw's vertex range, if its vertices directly follow the last draw's
+static std::optional<u32> merge_base_vertex(const DrawPacket& last, const Range& vertRange, u32 vtxCount) {
+  if (vtxCount == 0 || is_resident(vertRange) || last.vertRange.chunk != vertRange.chunk ||
+      last.vertRange.offset + last.vertRange.size != vertRange.offset) {
+    return std::nullopt;
+  }
+  const u32 stride = vertRange.size / vtxCount;
+  const u32 vertOffset = vertRange.offset - last.vertRange.offset;
+  if (stride == 0 || stride * vtxCount != vertRange.size || vertOffset % stride != 0) {
+    return std::nullopt;
+  }
+  return vertOffset / stride;
+}
+
+// Consecutive draws usually share their pipeline & bind groups, so only a change adds a table entry
+static u32 draw_pipeline_index(PipelineRef ref) {
+  if (g_drawPipelines.empty() || g_drawPipelines.back() != ref) {
+    g_drawPipelines.push_back(ref);
+  }
+  return g_drawPipelines.size() - 1;
+}
+static u32 draw_bind_groups_index(const gx::GXBindGroups& bindGroups) {
+  if (g_drawBindGroups.empty() || memcmp(&g_drawBindGroups.back(), &bindGroups, sizeof(bindGroups)) != 0) {
+    g_drawBindGroups.push_back(bindGroups);
+  }
+  return g_drawBindGroups.size() - 1;
 }
 
-static void push_draw_command(ShaderDrawCommand data) {
-  push_command(CommandType::Draw, Command::Data{.draw = data});
+static void push_draw_command(ShaderType type, const DrawPacket& packet, ArrayRef<u32> storageOffsets) {
+  const size_t offsetsSize = storageOffsets.size() * sizeof(u32);
+  if (auto* ptr = push_command(CommandType::Draw, sizeof(packet) + offsetsSize, static_cast<u8>(type))) {
+    memcpy(ptr, &packet, sizeof(packet));
+    if (offsetsSize > 0) {
+      memcpy(ptr + sizeof(packet), storageOffsets.data(), offsetsSize);
+    }
+  }
   ++g_drawCallCount;
 }
 
-static Command::Data::SetViewportCommand g_cachedViewport;
+static SetViewportCommand g_cachedViewport;
 void set_viewport(float left, float top, float width, float height, float znear, float zfar) noexcept {
-  Command::Data::SetViewportCommand cmd{left, top, width, height, znear, zfar};
+  SetViewportCommand cmd{left, top, width, height, znear, zfar};
   if (cmd != g_cachedViewport) {
-    push_command(CommandType::SetViewport, Command::Data{.setViewport = cmd});
+    push_command(CommandType::SetViewport, cmd);
     g_cachedViewport = cmd;
   }
 }
-static Command::Data::SetScissorCommand g_cachedScissor;
+static SetScissorCommand g_cachedScissor;
 void set_scissor(uint32_t x, uint32_t y, uint32_t w, uint32_t h) noexcept {
-  Command::Data::SetScissorCommand cmd{x, y, w, h};
+  SetScissorCommand cmd{x, y, w, h};
   if (cmd != g_cachedScissor) {
-    push_command(CommandType::SetScissor, Command::Data{.setScissor = cmd});
+    push_command(CommandType::SetScissor, cmd);
     g_cachedScissor = cmd;
   }
 }
 
+static void begin_render_pass() {
+  g_renderPasses[g_currentRenderPass].commandsBegin = g_commandsSize;
+  g_lastCommand = SIZE_MAX;
+#ifdef AURORA_GFX_DEBUG_GROUPS
+  // Groups are reopened in each pass
+  g_recordedDebugGroups.clear();
+  g_debugGroupsChanged = true;
+#endif
+}
+static void end_render_pass() { g_renderPasses[g_currentRenderPass].commandsEnd = g_commandsSize; }
+
 void resolve_pass(TextureHandle texture, ClipRect rect, bool clear, Vec4<float> clearColor) {
   auto& currentPass = aurora::gfx::g_renderPasses[g_currentRenderPass];
   currentPass.resolveTarget = std::move(texture);
   currentPass.resolveRect = rect;
+  end_render_pass();
   auto& newPass = g_renderPasses.emplace_back();
   newPass.clearColor = clearColor;
   newPass.clear = clear;
   ++g_currentRenderPass;
+  begin_render_pass();
 }
 
 template <>
@@ -280,65 +792,216 @@ const stream::State& get_state() {
 }
 template <>
 void push_draw_command(stream::DrawData data) {
-  push_draw_command(ShaderDrawCommand{.type = ShaderType::Stream, .stream = data});
+  push_draw_command(ShaderType::Stream,
+                    DrawPacket{
+                        .pipeline = draw_pipeline_index(data.pipeline),
+                        .bindGroups = draw_bind_groups_index(data.bindGroups),
+                        .vertRange = data.vertRange,
+                        .indexRange = data.indexRange,
+                        .uniformRanges = data.uniformRanges,
+                        .indexCount = data.indexCount,
+                        .dstAlpha = data.dstAlpha,
+                        .opaqueState = g_config.sortOpaqueDraws ? gx::opaque_draw_state() : u8{0},
+                        .perDrawStorage = data.perDrawStorage,
+                    },
+                    {});
 }
 template <>
-void merge_draw_command(stream::DrawData data) {
-  auto& last = get_last_draw_command(ShaderType::Stream).data.draw.stream;
-  CHECK(last.vertRange.offset + last.vertRange.size == data.vertRange.offset, "Invalid vertex merge range: {} -> {}",
-        last.vertRange.offset + last.vertRange.size, data.vertRange.offset);
-  CHECK(last.indexRange.offset + last.indexRange.size == data.indexRange.offset, "Invalid index merge range: {} -> {}",
-        last.indexRange.offset + last.indexRange.size, data.indexRange.offset);
-  last.vertRange.size += data.vertRange.size;
-  last.indexRange.size += data.indexRange.size;
-  last.indexCount += data.indexCount;
+bool merge_draw_command(stream::DrawData data) {
+  auto* last = get_last_draw_command(ShaderType::Stream);
+  if (last == nullptr) {
+    return false;
+  }
+  const auto baseVertex = merge_base_vertex(*last, data.vertRange, data.vtxCount);
+  if (!baseVertex || !append_draw_indices(*last, data.indexRange, data.indexCount, *baseVertex, data.vtxCount)) {
+    return false;
+  }
+  last->vertRange.size += data.vertRange.size;
   ++g_mergedDrawCallCount;
+  return true;
 }
 template <>
 PipelineRef pipeline_ref(stream::PipelineConfig config) {
-  return find_pipeline(ShaderType::Stream, config, [=]() { return create_pipeline(g_state.stream, config); });
+  const auto key = gx::pack_pipeline_config(config);
+  return find_pipeline(ShaderType::Stream, key, [=]() {
+    stream::PipelineConfig expanded;
+    gx::unpack_pipeline_config(key, expanded);
+    return create_pipeline(g_state.stream, expanded);
+  });
 }
 
 template <>
 void push_draw_command(model::DrawData data) {
-  push_draw_command(ShaderDrawCommand{.type = ShaderType::Model, .model = data});
+  // Only the offsets of bound ranges are needed to draw
+  std::array<u32, GX_VA_MAX_ATTR> storageOffsets;
+  u32 storageOffsetCount = 0;
+  for (const auto& range : data.dataRanges.vaRanges) {
+    if (range.size > 0) {
+      storageOffsets[storageOffsetCount++] = range.offset;
+    }
+  }
+  push_draw_command(ShaderType::Model,
+                    DrawPacket{
+                        .pipeline = draw_pipeline_index(data.pipeline),
+                        .bindGroups = draw_bind_groups_index(data.bindGroups),
+                        .vertRange = data.vertRange,
+                        .indexRange = data.idxRange,
+                        .uniformRanges = data.uniformRanges,
+                        .indexCount = data.indexCount,
+                        .dstAlpha = data.dstAlpha,
+                        .storageOffsetCount = static_cast<u8>(storageOffsetCount),
+                        .opaqueState = g_config.sortOpaqueDraws ? gx::opaque_draw_state() : u8{0},
+                        .wideIndices = is_resident(data.idxRange),
+                        .perDrawStorage = data.perDrawStorage,
+                    },
+                    {storageOffsets.data(), storageOffsetCount});
+}
+template <>
+bool merge_draw_command(model::DrawData data) {
+  auto* last = get_last_draw_command(ShaderType::Model);
+  if (last == nullptr) {
+    return false;
+  }
+  const auto* lastStorageOffsets = reinterpret_cast<const u32*>(last + 1);
+  u32 storageOffsetCount = 0;
+  for (const auto& range : data.dataRanges.vaRanges) {
+    if (range.size == 0) {
+      continue;
+    }
+    if (storageOffsetCount == last->storageOffsetCount || lastStorageOffsets[storageOffsetCount] != range.offset) {
+      return false;
+    }
+    ++storageOffsetCount;
+  }
+  if (storageOffsetCount != last->storageOffsetCount) {
+    return false;
+  }
+  if (is_resident(data.idxRange)) {
+    // Already rebased onto the start of their run's vertex binding, see push_display_list
+    if (!is_resident(last->indexRange) || last->vertRange.chunk != data.vertRange.chunk ||
+        last->vertRange.offset != data.vertRange.offset || last->indexRange.chunk != data.idxRange.chunk ||
+        last->indexRange.offset + last->indexRange.size != data.idxRange.offset) {
+      return false;
+    }
+    last->vertRange.size = std::max(last->vertRange.size, data.vertRange.size);
+    last->indexRange.size += data.idxRange.size;
+    last->indexCount += data.indexCount;
+    ++g_mergedDrawCallCount;
+    return true;
+  }
+  // Display list indices start at 0, rebase them onto the last draw's vertex buffer binding
+  const auto baseVertex = merge_base_vertex(*last, data.vertRange, data.vtxCount);
+  if (!baseVertex || !append_draw_indices(*last, data.idxRange, data.indexCount, *baseVertex, data.vtxCount)) {
+    return false;
+  }
+  last->vertRange.size += data.vertRange.size;
+  ++g_mergedDrawCallCount;
+  return true;
 }
 template <>
 PipelineRef pipeline_ref(model::PipelineConfig config) {
-  return find_pipeline(ShaderType::Model, config, [=]() { return create_pipeline(g_state.model, config); });
+  const auto key = gx::pack_pipeline_config(config);
+  return find_pipeline(ShaderType::Model, key, [=]() {
+    model::PipelineConfig expanded;
+    gx::unpack_pipeline_config(key, expanded);
+    return create_pipeline(g_state.model, expanded);
+  });
+}
+
+// Requires g_pipelineMutex
+static bool pop_queued_pipeline(PipelineRef& ref, NewPipelineCallback& cb) {
+  for (auto& queue : g_pipelineQueues) {
+    while (!queue.empty()) {
+      const auto hash = queue.front();
+      queue.pop_front();
+      const auto it = g_queuedPipelines.find(hash);
+      if (it == g_queuedPipelines.end() || !it->second.cb) {
+        continue;
+      }
+      ref = hash;
+      cb = std::move(it->second.cb);
+      it->second.cb = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void finish_queued_pipeline(PipelineRef ref, wgpu::RenderPipeline&& pipeline) {
+  {
+    std::scoped_lock lock{g_pipelineMutex};
+    ASSERT(g_builtPipelines.try_emplace(ref, std::move(pipeline)).second, "Duplicate pipeline {}", ref);
+    g_queuedPipelines.erase(ref);
+  }
+  createdPipelines++;
+  queuedPipelines--;
 }
 
 static void pipeline_worker() {
-  bool hasMore = false;
-  while (g_hasPipelineThread || g_pipelinesPerFrame < BuildPipelinesPerFrame) {
-    std::pair<PipelineRef, NewPipelineCallback> cb;
+  while (true) {
+    PipelineRef ref;
+    NewPipelineCallback cb;
     {
       std::unique_lock lock{g_pipelineMutex};
-      if (g_hasPipelineThread) {
-        if (!hasMore) {
-          g_pipelineCv.wait(lock, [] { return !g_queuedPipelines.empty() || g_pipelineThreadEnd; });
-        }
-      } else if (g_queuedPipelines.empty()) {
-        return;
-      }
+      g_pipelineCv.wait(lock, [&] { return g_pipelineThreadEnd || pop_queued_pipeline(ref, cb); });
       if (g_pipelineThreadEnd) {
         break;
       }
-      cb = std::move(g_queuedPipelines.front());
     }
-    auto result = cb.second();
+    auto result = cb();
     // std::this_thread::sleep_for(std::chrono::milliseconds{1500});
+    finish_queued_pipeline(ref, std::move(result));
+  }
+}
+
+// For backends without a pipeline thread, build within the remaining frame budget
+static void build_queued_pipelines() {
+  while (has_pipeline_budget()) {
+    PipelineRef ref;
+    NewPipelineCallback cb;
     {
       std::scoped_lock lock{g_pipelineMutex};
-      ASSERT(g_pipelines.try_emplace(cb.first, std::move(result)).second, "Duplicate pipeline {}", cb.first);
-      g_queuedPipelines.pop_front();
-      hasMore = !g_queuedPipelines.empty();
-    }
-    if (!g_hasPipelineThread) {
-      ++g_pipelinesPerFrame;
+      if (!pop_queued_pipeline(ref, cb)) {
+        return;
+      }
     }
-    createdPipelines++;
-    queuedPipelines--;
+    finish_queued_pipeline(ref, build_pipeline_sync(cb));
+  }
+}
+
+static void enqueue_cached_pipeline(ShaderType type, const u8* data, u32 size, PipelinePriority priority) {
+  gx::PipelineKey key;
+  if (size != sizeof(key)) {
+    return;
+  }
+  memcpy(&key, data, size);
+  if (key.version != gx::GXPipelineConfigVersion) {
+    return;
+  }
+  switch (type) {
+  case ShaderType::Stream:
+    find_pipeline(
+        type, key,
+        [=]() {
+          stream::PipelineConfig config;
+          gx::unpack_pipeline_config(key, config);
+          return stream::create_pipeline(g_state.stream, config);
+        },
+        priority);
+    break;
+  case ShaderType::Model:
+    find_pipeline(
+        type, key,
+        [=]() {
+          model::PipelineConfig config;
+          gx::unpack_pipeline_config(key, config);
+          return model::create_pipeline(g_state.model, config);
+        },
+        priority);
+    break;
+  default:
+    Log.report(LOG_WARNING, FMT_STRING("Unknown pipeline type {}"), static_cast<int>(type));
+    break;
   }
 }
 
@@ -349,232 +1012,407 @@ void initialize() {
     g_hasPipelineThread = false;
   } else {
     g_pipelineThreadEnd = false;
-    g_pipelineThread = std::thread(pipeline_worker);
+    for (u32 i = 0; i < g_config.pipelineThreadCount; ++i) {
+      g_pipelineThreads.emplace_back(pipeline_worker);
+    }
     g_hasPipelineThread = true;
+    Log.report(LOG_INFO, FMT_STRING("Using {} pipeline threads"), g_pipelineThreads.size());
   }
 
   // For uniform & storage buffer offset alignments
   g_device.GetLimits(&g_cachedLimits);
+  g_residentArrayPool.alignment = g_cachedLimits.limits.minStorageBufferOffsetAlignment;
+  g_residentArrayPool.maxBlockSize = std::min(MaxBufferChunkSize, g_cachedLimits.limits.maxStorageBufferBindingSize);
+  g_residentUniformPool.alignment = g_cachedLimits.limits.minUniformBufferOffsetAlignment;
+  g_residentUniformPool.blockSize = ResidentUniformBlockSize;
 
-  const auto createBuffer = [](wgpu::Buffer& out, wgpu::BufferUsage usage, uint64_t size, const char* label) {
-    if (size <= 0) {
-      return;
+  if (g_config.framesInFlight != 0) {
+    g_framesInFlight = std::clamp(g_config.framesInFlight, static_cast<uint32_t>(MinFramesInFlight),
+                                  static_cast<uint32_t>(MaxFramesInFlight));
+  }
+  if (g_config.perDrawStorage) {
+    // Per-draw storage binds whole uniform chunks as storage buffers
+    g_uniformRing.usage |= wgpu::BufferUsage::Storage;
+    g_uniformRing.maxChunkSize = std::min(MaxBufferChunkSize, g_cachedLimits.limits.maxStorageBufferBindingSize);
+  }
+  if (g_config.bindGroupCacheSize != 0) {
+    g_bindGroupCacheSize = g_config.bindGroupCacheSize;
+  }
+  if (g_config.displayListCacheSize != 0) {
+    g_displayListBudget = g_config.displayListCacheSize;
+  }
+  g_bindGroupCacheActive = true;
+  load_buffer_sizes();
+  g_vertexRing.initialSize = initial_buffer_size(g_vertexRing, g_config.vertexBufferSize, VertexBufferSize);
+  g_uniformRing.initialSize = initial_buffer_size(g_uniformRing, g_config.uniformBufferSize, UniformBufferSize);
+  g_indexRing.initialSize = initial_buffer_size(g_indexRing, g_config.indexBufferSize, IndexBufferSize);
+  g_storageRing.initialSize = initial_buffer_size(g_storageRing, g_config.storageBufferSize, StorageBufferSize);
+  g_textureUploadRing.initialSize =
+      initial_buffer_size(g_textureUploadRing, g_config.textureUploadSize, TextureUploadSize);
+  for (auto* ring : g_bufferRings) {
+    ring->chunkSize = ring->initialSize;
+    // Texture upload chunks are only allocated once needed
+    if (ring->usage != wgpu::BufferUsage::None) {
+      add_buffer_chunk(*ring, ring->chunkSize);
     }
-    const wgpu::BufferDescriptor descriptor{
-        .label = label,
-        .usage = usage,
-        .size = size,
-    };
-    out = g_device.CreateBuffer(&descriptor);
-  };
-  createBuffer(g_uniformBuffer, wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst, UniformBufferSize,
-               "Shared Uniform Buffer");
-  createBuffer(g_vertexBuffer, wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst, VertexBufferSize,
-               "Shared Vertex Buffer");
-  createBuffer(g_indexBuffer, wgpu::BufferUsage::Index | wgpu::BufferUsage::CopyDst, IndexBufferSize,
-               "Shared Index Buffer");
-  createBuffer(g_storageBuffer, wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst, StorageBufferSize,
-               "Shared Storage Buffer");
-  for (int i = 0; i < g_stagingBuffers.size(); ++i) {
-    const auto label = fmt::format(FMT_STRING("Staging Buffer {}"), i);
-    createBuffer(g_stagingBuffers[i], wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc, StagingBufferSize,
-                 label.c_str());
   }
-  map_staging_buffer();
 
   g_state.stream = stream::construct_state();
   g_state.model = model::construct_state();
 
-  {
-    // Load serialized pipeline cache
-    std::string path = std::string{g_config.configPath} + "/pipeline_cache.bin";
-    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
-    if (file) {
-      const auto size = file.tellg();
-      file.seekg(0, std::ios::beg);
-      constexpr size_t headerSize = sizeof(g_serializedPipelineCount);
-      if (size != -1 && size > headerSize) {
-        g_serializedPipelines.append_zeroes(size_t(size) - headerSize);
-        file.read(reinterpret_cast<char*>(&g_serializedPipelineCount), headerSize);
-        file.read(reinterpret_cast<char*>(g_serializedPipelines.data()), size_t(size) - headerSize);
-      }
-    }
-  }
-  if (g_serializedPipelineCount > 0) {
-    size_t offset = 0;
-    while (offset < g_serializedPipelines.size()) {
-      ShaderType type = *reinterpret_cast<const ShaderType*>(g_serializedPipelines.data() + offset);
-      offset += sizeof(ShaderType);
-      u32 size = *reinterpret_cast<const u32*>(g_serializedPipelines.data() + offset);
-      offset += sizeof(u32);
-      switch (type) {
-      case ShaderType::Stream: {
-        if (size != sizeof(stream::PipelineConfig)) {
-          break;
-        }
-        const auto config = *reinterpret_cast<const stream::PipelineConfig*>(g_serializedPipelines.data() + offset);
-        if (config.version != gx::GXPipelineConfigVersion) {
-          break;
-        }
-        find_pipeline(
-            type, config, [=]() { return stream::create_pipeline(g_state.stream, config); }, false);
-      } break;
-      case ShaderType::Model: {
-        if (size != sizeof(model::PipelineConfig)) {
-          break;
-        }
-        const auto config = *reinterpret_cast<const model::PipelineConfig*>(g_serializedPipelines.data() + offset);
-        if (config.version != gx::GXPipelineConfigVersion) {
-          break;
-        }
-        find_pipeline(
-            type, config, [=]() { return model::create_pipeline(g_state.model, config); }, false);
-      } break;
-      default:
-        Log.report(LOG_WARNING, FMT_STRING("Unknown pipeline type {}"), static_cast<int>(type));
-        break;
-      }
-      offset += size;
-    }
-  }
+  g_replayStart = std::chrono::steady_clock::now();
+  pipeline_cache::initialize(gx::GXPipelineConfigVersion, [](ShaderType type, const u8* data, u32 size) {
+    enqueue_cached_pipeline(type, data, size, PipelinePriority::Replay);
+  });
+  g_replayPending = queuedPipelines > 0;
 }
 
 void shutdown() {
   if (g_hasPipelineThread) {
     g_pipelineThreadEnd = true;
     g_pipelineCv.notify_all();
-    g_pipelineThread.join();
-  }
-
-  {
-    // Write serialized pipelines to file
-    const auto path = std::string{g_config.configPath} + "pipeline_cache.bin";
-    std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
-    if (file) {
-      file.write(reinterpret_cast<const char*>(&g_serializedPipelineCount), sizeof(g_serializedPipelineCount));
-      file.write(reinterpret_cast<const char*>(g_serializedPipelines.data()), g_serializedPipelines.size());
+    for (auto& thread : g_pipelineThreads) {
+      thread.join();
     }
-    g_serializedPipelines.clear();
-    g_serializedPipelineCount = 0;
+    g_pipelineThreads.clear();
   }
 
+  pipeline_cache::shutdown();
   gx::shutdown();
 
   g_textureUploads.clear();
   g_cachedBindGroups.clear();
+  g_releasedTextureViews.clear();
+  g_residentArrays.clear();
+  g_residentDisplayLists.clear();
+  g_displayListRun = {};
+  g_residentUniforms.clear();
+  g_drawUniforms.clear();
+  g_lastDrawUniforms.clear();
+  for (auto* pool : {&g_residentArrayPool, &g_residentVertexPool, &g_residentIndexPool, &g_residentUniformPool}) {
+    pool->blocks.clear();
+    pool->used = 0;
+  }
+  g_displayListBudget = DisplayListBudget;
+  g_bindGroupCacheSize = DefaultBindGroupCacheSize;
+  g_bindGroupCacheActive = false;
   g_cachedSamplers.clear();
   g_pipelines.clear();
+  g_builtPipelines.clear();
   g_queuedPipelines.clear();
-  g_vertexBuffer = {};
-  g_uniformBuffer = {};
-  g_indexBuffer = {};
-  g_storageBuffer = {};
-  g_stagingBuffers.fill({});
+  for (auto& queue : g_pipelineQueues) {
+    queue.clear();
+  }
+  save_buffer_sizes();
+  for (auto* ring : g_bufferRings) {
+    ring->chunks.clear();
+    ring->current = 0;
+    ring->pendingChunkSize = 0;
+    ring->lastUsed = 0;
+    ring->highWater = 0;
+    ring->sessionHighWater = 0;
+    ring->persistedHighWater = UINT64_MAX;
+  }
+  g_pendingMaps = 0;
+  currentStagingBuffer = 0;
+  g_framesInFlight = DefaultFramesInFlight;
+  g_gpuWaitStart.reset();
+  g_lastGpuWaitTime = {};
   g_renderPasses.clear();
   g_currentRenderPass = UINT32_MAX;
+  g_commands = {};
+  g_commandsSize = 0;
+  g_commandOrder = {};
+  g_drawPipelines = {};
+  g_drawBindGroups = {};
+#ifdef AURORA_GFX_DEBUG_GROUPS
+  g_debugLabels = {};
+  g_recordedDebugGroups = {};
+#endif
 
   g_state = {};
 
   queuedPipelines = 0;
   createdPipelines = 0;
+  g_replayPending = false;
+  g_frameIndex = 0;
 }
 
-static size_t currentStagingBuffer = 0;
-static bool bufferMapped = false;
 void map_staging_buffer() {
-  bufferMapped = false;
-  g_stagingBuffers[currentStagingBuffer].MapAsync(
-      wgpu::MapMode::Write, 0, StagingBufferSize,
-      [](WGPUBufferMapAsyncStatus status, void* userdata) {
-        if (status == WGPUBufferMapAsyncStatus_DestroyedBeforeCallback) {
-          return;
-        }
-        ASSERT(status == WGPUBufferMapAsyncStatus_Success, "Buffer mapping failed: {}", static_cast<int>(status));
-        *static_cast<bool*>(userdata) = true;
-      },
-      &bufferMapped);
+  for (auto* ring : g_bufferRings) {
+    for (auto& chunk : ring->chunks) {
+      auto& staging = chunk.staging[currentStagingBuffer];
+      if (!staging) {
+        // Created mapped by begin_frame
+        continue;
+      }
+      ++g_pendingMaps;
+      staging.MapAsync(
+          wgpu::MapMode::Write, 0, chunk.size,
+          [](WGPUBufferMapAsyncStatus status, void* userdata) {
+            --g_pendingMaps;
+            if (status == WGPUBufferMapAsyncStatus_DestroyedBeforeCallback) {
+              return;
+            }
+            ASSERT(status == WGPUBufferMapAsyncStatus_Success, "Buffer mapping failed: {}", static_cast<int>(status));
+          },
+          nullptr);
+    }
+  }
 }
 
-void begin_frame() {
-  while (!bufferMapped) {
+bool frame_ready(bool wait) {
+  if (g_pendingMaps > 0 && !g_gpuWaitStart) {
+    g_gpuWaitStart = std::chrono::steady_clock::now();
+  }
+  while (g_pendingMaps > 0) {
 #ifdef EMSCRIPTEN
+    if (!wait) {
+      return false;
+    }
     emscripten_sleep(0);
 #else
+    // No blocking wait for map callbacks in this Dawn; tick until they fire
     g_device.Tick();
+    if (g_pendingMaps == 0) {
+      break;
+    }
+    if (!wait) {
+      return false;
+    }
+    std::this_thread::yield();
 #endif
   }
-  size_t bufferOffset = 0;
-  auto& stagingBuf = g_stagingBuffers[currentStagingBuffer];
-  const auto mapBuffer = [&](ByteBuffer& buf, uint64_t size) {
-    if (size <= 0) {
-      return;
+  if (g_gpuWaitStart) {
+    g_lastGpuWaitTime = std::chrono::steady_clock::now() - *g_gpuWaitStart;
+    g_gpuWaitStart.reset();
+  } else {
+    g_lastGpuWaitTime = {};
+  }
+  return true;
+}
+
+static void free_resident_range(ResidentPool& pool, const Range& range) {
+  auto& block = pool.blocks[range.chunk & ~ResidentChunkFlag];
+  uint64_t offset = range.offset;
+  uint64_t size = ALIGN(range.size, pool.alignment);
+  pool.used -= size;
+  auto next = block.free.lower_bound(offset);
+  if (next != block.free.end() && offset + size == next->first) {
+    size += next->second;
+    next = block.free.erase(next);
+  }
+  if (next != block.free.begin()) {
+    const auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      block.free.erase(prev);
     }
-    buf = ByteBuffer{static_cast<u8*>(stagingBuf.GetMappedRange(bufferOffset, size)), static_cast<size_t>(size)};
-    bufferOffset += size;
-  };
-  mapBuffer(g_verts, VertexBufferSize);
-  mapBuffer(g_uniforms, UniformBufferSize);
-  mapBuffer(g_indices, IndexBufferSize);
-  mapBuffer(g_storage, StorageBufferSize);
-  mapBuffer(g_textureUpload, TextureUploadSize);
+  }
+  if (size == block.size) {
+    // Bind groups still referencing the buffer keep it alive until they're evicted. The last draw's are reused by
+    // block index, which a new block may take over.
+    block = {};
+    gx::g_lastDraw.reset();
+    return;
+  }
+  block.free.emplace(offset, size);
+}
+
+template <typename Keep>
+static void evict_unused(absl::flat_hash_map<HashType, ResidentRange>& entries, ResidentPool& pool, Keep keep) {
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (g_frameIndex - it->second.lastUsedFrame > ResidentLifetime && !keep(it->second.range)) {
+      free_resident_range(pool, it->second.range);
+      entries.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+static void evict_resident_ranges() {
+  std::swap(g_drawUniforms, g_lastDrawUniforms);
+  g_drawUniforms.clear();
+  if (g_frameIndex % ResidentEvictInterval != 0) {
+    return;
+  }
+  // Arrays still cached in GX state are drawn from without being looked up again
+  evict_unused(g_residentArrays, g_residentArrayPool, [](const Range& range) {
+    return std::ranges::any_of(gx::g_gxState.arrays, [&](const auto& array) { return array.cachedRange == range; });
+  });
+  evict_unused(g_residentUniforms, g_residentUniformPool, [](const Range&) { return false; });
+}
+
+// Least recently used display lists past the budget, sparing those drawn last frame
+static void evict_display_lists() {
+  const auto used = [] { return g_residentVertexPool.used + g_residentIndexPool.used; };
+  if (used() <= g_displayListBudget) {
+    return;
+  }
+  std::vector<std::pair<u32, HashType>> lru;
+  for (const auto& [key, entry] : g_residentDisplayLists) {
+    if (entry.lastUsedFrame + 1 < g_frameIndex) {
+      lru.emplace_back(entry.lastUsedFrame, key);
+    }
+  }
+  std::ranges::sort(lru);
+  for (const auto& [frame, key] : lru) {
+    if (used() <= g_displayListBudget) {
+      break;
+    }
+    const auto it = g_residentDisplayLists.find(key);
+    free_resident_range(g_residentVertexPool, it->second.vertRange);
+    free_resident_range(g_residentIndexPool, it->second.idxRange);
+    g_residentDisplayLists.erase(it);
+  }
+}
+
+// Runs before the frame records any draws, so only the last frame's commands (already encoded) referenced the
+// evicted bind groups
+static void evict_bind_groups() {
+  size_t evicted = 0;
+  if (!g_releasedTextureViews.empty()) {
+    const auto released = [](WGPUTextureView view) { return g_releasedTextureViews.contains(view); };
+    for (auto it = g_cachedBindGroups.begin(); it != g_cachedBindGroups.end();) {
+      if (std::ranges::any_of(it->second.textureViews, released)) {
+        g_cachedBindGroups.erase(it++);
+        ++evicted;
+      } else {
+        ++it;
+      }
+    }
+    g_releasedTextureViews.clear();
+  }
+  if (g_cachedBindGroups.size() > g_bindGroupCacheSize) {
+    // Evict down to 3/4 of the cap so it isn't hit again every frame
+    const size_t count = g_cachedBindGroups.size() - (g_bindGroupCacheSize - g_bindGroupCacheSize / 4);
+    std::vector<u32> frames;
+    frames.reserve(g_cachedBindGroups.size());
+    for (const auto& [id, entry] : g_cachedBindGroups) {
+      frames.push_back(entry.lastUsedFrame);
+    }
+    std::nth_element(frames.begin(), frames.begin() + (count - 1), frames.end());
+    const u32 threshold = frames[count - 1];
+    size_t lruEvicted = 0;
+    for (auto it = g_cachedBindGroups.begin(); it != g_cachedBindGroups.end() && lruEvicted < count;) {
+      if (it->second.lastUsedFrame <= threshold) {
+        g_cachedBindGroups.erase(it++);
+        ++lruEvicted;
+      } else {
+        ++it;
+      }
+    }
+    evicted += lruEvicted;
+  }
+  g_bindGroupEvictions = evicted;
+  if (evicted != 0) {
+    gx::g_lastDraw.reset();
+  }
+}
+
+void begin_frame() {
+  // aurora::begin_frame only gets here once frame_ready has seen the staging buffers mapped
+  ASSERT(g_pendingMaps == 0, "begin_frame called before frame_ready");
+  for (auto* ring : g_bufferRings) {
+    ring->current = 0;
+    ring->used = 0;
+    ring->spilled = false;
+    for (auto& chunk : ring->chunks) {
+      begin_buffer_chunk(*ring, chunk);
+    }
+  }
+  // Ring ranges don't outlive the frame they were pushed in
+  for (auto& array : gx::g_gxState.arrays) {
+    if (!is_resident(array.cachedRange)) {
+      array.cachedRange = {};
+    }
+  }
 
   g_drawCallCount = 0;
   g_mergedDrawCallCount = 0;
+  g_dedupedUniformSize = 0;
+  g_bindGroupHits = 0;
+  g_bindGroupMisses = 0;
+  gx::g_createdLayouts = 0;
+  g_residentUploadSize = 0;
+  evict_bind_groups();
+  evict_resident_ranges();
+  evict_display_lists();
+  g_residentArraySize = g_residentArrayPool.used;
+  g_residentUniformSize = g_residentUniformPool.used;
+  g_residentDisplayListSize = g_residentVertexPool.used + g_residentIndexPool.used;
+  g_stateCallCount = 0;
+  g_skippedStateCallCount = 0;
 
   g_renderPasses.emplace_back();
   g_renderPasses[0].clearColor = gx::g_gxState.clearColor;
   g_currentRenderPass = 0;
-  // push_command(CommandType::SetViewport, Command::Data{.setViewport = g_cachedViewport});
-  // push_command(CommandType::SetScissor, Command::Data{.setScissor = g_cachedScissor});
+  begin_render_pass();
+  // push_command(CommandType::SetViewport, g_cachedViewport);
+  // push_command(CommandType::SetScissor, g_cachedScissor);
 
   if (!g_hasPipelineThread) {
     g_pipelinesPerFrame = 0;
+    g_pipelineTimePerFrame = {};
   }
+  publish_pipelines();
 }
 
 void end_frame(const wgpu::CommandEncoder& cmd) {
-  uint64_t bufferOffset = 0;
-  const auto writeBuffer = [&](ByteBuffer& buf, wgpu::Buffer& out, uint64_t size, std::string_view label) {
-    const auto writeSize = buf.size(); // Only need to copy this many bytes
-    if (writeSize > 0) {
-      cmd.CopyBufferToBuffer(g_stagingBuffers[currentStagingBuffer], bufferOffset, out, 0, ALIGN(writeSize, 4));
-      buf.clear();
-    }
-    bufferOffset += size;
-    return writeSize;
-  };
-  g_stagingBuffers[currentStagingBuffer].Unmap();
-  g_lastVertSize = writeBuffer(g_verts, g_vertexBuffer, VertexBufferSize, "Vertex");
-  g_lastUniformSize = writeBuffer(g_uniforms, g_uniformBuffer, UniformBufferSize, "Uniform");
-  g_lastIndexSize = writeBuffer(g_indices, g_indexBuffer, IndexBufferSize, "Index");
-  g_lastStorageSize = writeBuffer(g_storage, g_storageBuffer, StorageBufferSize, "Storage");
+  for (auto* ring : g_bufferRings) {
+    for (auto& chunk : ring->chunks) {
+      const auto writeSize = chunk.data.size(); // Only need to copy this many bytes
+      const auto& staging = chunk.staging[currentStagingBuffer];
+      staging.Unmap();
+      chunk.data = {};
+      if (writeSize > 0 && chunk.buffer) {
+        cmd.CopyBufferToBuffer(staging, 0, chunk.buffer, 0, ALIGN(writeSize, 4));
+      }
+    }
+    update_buffer_ring_size(*ring);
+  }
+  g_lastVertSize = g_vertexRing.lastUsed;
+  g_lastUniformSize = g_uniformRing.lastUsed;
+  g_lastIndexSize = g_indexRing.lastUsed;
+  g_lastStorageSize = g_storageRing.lastUsed;
   {
     // Perform texture copies
     for (const auto& item : g_textureUploads) {
       const wgpu::ImageCopyBuffer buf{
           .layout =
               wgpu::TextureDataLayout{
-                  .offset = item.layout.offset + bufferOffset,
+                  .offset = item.layout.offset,
                   .bytesPerRow = ALIGN(item.layout.bytesPerRow, 256),
                   .rowsPerImage = item.layout.rowsPerImage,
               },
-          .buffer = g_stagingBuffers[currentStagingBuffer],
+          .buffer = g_textureUploadRing.chunks[item.chunk].staging[currentStagingBuffer],
       };
       cmd.CopyBufferToTexture(&buf, &item.tex, &item.size);
     }
     g_textureUploads.clear();
-    g_textureUpload.clear();
   }
-  currentStagingBuffer = (currentStagingBuffer + 1) % g_stagingBuffers.size();
+  currentStagingBuffer = (currentStagingBuffer + 1) % g_framesInFlight;
   map_staging_buffer();
+  end_render_pass();
   g_currentRenderPass = UINT32_MAX;
 
   if (!g_hasPipelineThread) {
-    pipeline_worker();
+    build_queued_pipelines();
   }
+  if (g_replayPending && queuedPipelines == 0) {
+    const auto elapsed = std::chrono::steady_clock::now() - g_replayStart;
+    Log.report(LOG_INFO, FMT_STRING("Pipeline cache replay finished: {} pipelines in {} ms"), createdPipelines.load(),
+               std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    g_replayPending = false;
+  }
+  ++g_frameIndex;
 }
 
 void render(wgpu::CommandEncoder& cmd) {
+  // Pipelines finished while recording can draw this frame already
+  publish_pipelines();
   for (u32 i = 0; i < g_renderPasses.size(); ++i) {
     const auto& passInfo = g_renderPasses[i];
     if (i == g_renderPasses.size() - 1) {
@@ -637,83 +1475,219 @@ void render(wgpu::CommandEncoder& cmd) {
     }
   }
   g_renderPasses.clear();
+  g_commandsSize = 0;
+  g_lastCommand = SIZE_MAX;
+  g_drawPipelines.clear();
+  g_drawBindGroups.clear();
+#ifdef AURORA_GFX_DEBUG_GROUPS
+  g_debugLabels.clear();
+#endif
+  resize_buffer_rings();
 }
 
-void render_pass(const wgpu::RenderPassEncoder& pass, u32 idx) {
-  g_currentPipeline = UINTPTR_MAX;
+static void replay_command(const u8* ptr, const wgpu::RenderPassEncoder& pass, [[maybe_unused]] u32& debugGroupDepth) {
+  const auto& header = *reinterpret_cast<const CommandHeader*>(ptr);
+  const u8* payload = ptr + sizeof(CommandHeader);
+  switch (header.type) {
+  case CommandType::SetViewport: {
+    const auto& vp = *reinterpret_cast<const SetViewportCommand*>(payload);
+    pass.SetViewport(vp.left, vp.top, vp.width, vp.height, vp.znear, vp.zfar);
+  } break;
+  case CommandType::SetScissor: {
+    const auto& sc = *reinterpret_cast<const SetScissorCommand*>(payload);
+    pass.SetScissorRect(sc.x, sc.y, sc.w, sc.h);
+  } break;
+  case CommandType::Draw: {
+    const auto& packet = *reinterpret_cast<const DrawPacket*>(payload);
+    const gx::DrawCommand draw{
+        .pipeline = g_drawPipelines[packet.pipeline],
+        .bindGroups = g_drawBindGroups[packet.bindGroups],
+        .vertRange = packet.vertRange,
+        .indexRange = packet.indexRange,
+        .uniformRanges = packet.uniformRanges,
+        .indexCount = packet.indexCount,
+        .indexFormat = packet.wideIndices ? wgpu::IndexFormat::Uint32 : wgpu::IndexFormat::Uint16,
+        .perDrawStorage = packet.perDrawStorage,
+        .firstInstance = packet.perDrawStorage ? packet.uniformRanges.draw.offset / packet.uniformRanges.draw.size : 0,
+        .dstAlpha = packet.dstAlpha,
+        .storageOffsets = {reinterpret_cast<const u32*>(payload + sizeof(DrawPacket)), packet.storageOffsetCount},
+    };
+    switch (static_cast<ShaderType>(header.shaderType)) {
+    case ShaderType::Stream:
+      stream::render(g_state.stream, draw, pass);
+      break;
+    case ShaderType::Model:
+      model::render(g_state.model, draw, pass);
+      break;
+    }
+  } break;
+  case CommandType::PushDebugGroup: {
 #ifdef AURORA_GFX_DEBUG_GROUPS
-  std::vector<std::string> lastDebugGroupStack;
+    const auto& group = *reinterpret_cast<const DebugGroupPacket*>(payload);
+    pass.PushDebugGroup(g_debugLabels[group.label].c_str());
+    ++debugGroupDepth;
 #endif
-
-  for (const auto& cmd : g_renderPasses[idx].commands) {
+  } break;
+  case CommandType::PopDebugGroup: {
 #ifdef AURORA_GFX_DEBUG_GROUPS
-    {
-      size_t firstDiff = lastDebugGroupStack.size();
-      for (size_t i = 0; i < lastDebugGroupStack.size(); ++i) {
-        if (i >= cmd.debugGroupStack.size() || cmd.debugGroupStack[i] != lastDebugGroupStack[i]) {
-          firstDiff = i;
-          break;
-        }
-      }
-      for (size_t i = firstDiff; i < lastDebugGroupStack.size(); ++i) {
-        pass.PopDebugGroup();
-      }
-      for (size_t i = firstDiff; i < cmd.debugGroupStack.size(); ++i) {
-        pass.PushDebugGroup(cmd.debugGroupStack[i].c_str());
-      }
-      lastDebugGroupStack = cmd.debugGroupStack;
-    }
+    pass.PopDebugGroup();
+    --debugGroupDepth;
 #endif
-    switch (cmd.type) {
-    case CommandType::SetViewport: {
-      const auto& vp = cmd.data.setViewport;
-      pass.SetViewport(vp.left, vp.top, vp.width, vp.height, vp.znear, vp.zfar);
-    } break;
-    case CommandType::SetScissor: {
-      const auto& sc = cmd.data.setScissor;
-      pass.SetScissorRect(sc.x, sc.y, sc.w, sc.h);
-    } break;
-    case CommandType::Draw: {
-      const auto& draw = cmd.data.draw;
-      switch (draw.type) {
-      case ShaderType::Stream:
-        stream::render(g_state.stream, draw.stream, pass);
-        break;
-      case ShaderType::Model:
-        model::render(g_state.model, draw.model, pass);
-        break;
-      }
-    } break;
+  } break;
+  }
+}
+
+static std::pair<PipelineRef, BindGroupRef> draw_sort_key(u32 offset) {
+  const auto& packet = *reinterpret_cast<const DrawPacket*>(g_commands.data() + offset + sizeof(CommandHeader));
+  return {g_drawPipelines[packet.pipeline], g_drawBindGroups[packet.bindGroups].textureBindGroup};
+}
+
+// Fills g_commandOrder: runs of opaque draws with the same depth state are stably sorted by pipeline & textures,
+// every other command keeps its place and ends the run before it.
+static void sort_opaque_draws(const RenderPass& renderPass) {
+  g_commandOrder.clear();
+  size_t runBegin = 0;
+  u8 runState = 0;
+  const auto sortRun = [&] {
+    if (g_commandOrder.size() - runBegin > 1) {
+      std::stable_sort(g_commandOrder.begin() + runBegin, g_commandOrder.end(),
+                       [](u32 a, u32 b) { return draw_sort_key(a) < draw_sort_key(b); });
+    }
+  };
+  for (size_t offset = renderPass.commandsBegin; offset < renderPass.commandsEnd;) {
+    const auto& header = *reinterpret_cast<const CommandHeader*>(g_commands.data() + offset);
+    u8 state = 0;
+    if (header.type == CommandType::Draw) {
+      state = reinterpret_cast<const DrawPacket*>(g_commands.data() + offset + sizeof(header))->opaqueState;
+    }
+    if (state == 0 || state != runState) {
+      sortRun();
+      runBegin = state == 0 ? g_commandOrder.size() + 1 : g_commandOrder.size();
+      runState = state;
+    }
+    g_commandOrder.push_back(offset);
+    offset += header.size;
+  }
+  sortRun();
+}
+
+void render_pass(const wgpu::RenderPassEncoder& pass, u32 idx) {
+  g_passState = {};
+  u32 debugGroupDepth = 0;
+
+  const auto& renderPass = g_renderPasses[idx];
+  if (g_config.sortOpaqueDraws) {
+    sort_opaque_draws(renderPass);
+    for (const u32 offset : g_commandOrder) {
+      replay_command(g_commands.data() + offset, pass, debugGroupDepth);
+    }
+  } else {
+    const u8* ptr = g_commands.data() + renderPass.commandsBegin;
+    const u8* const end = g_commands.data() + renderPass.commandsEnd;
+    while (ptr < end) {
+      replay_command(ptr, pass, debugGroupDepth);
+      ptr += reinterpret_cast<const CommandHeader*>(ptr)->size;
     }
   }
 
 #ifdef AURORA_GFX_DEBUG_GROUPS
-  for (size_t i = 0; i < lastDebugGroupStack.size(); ++i) {
+  for (u32 i = 0; i < debugGroupDepth; ++i) {
     pass.PopDebugGroup();
   }
 #endif
 }
 
+bool pipeline_ready(PipelineRef ref) { return g_pipelines.contains(ref); }
+
 bool bind_pipeline(PipelineRef ref, const wgpu::RenderPassEncoder& pass) {
-  if (ref == g_currentPipeline) {
+  if (ref == g_passState.pipeline) {
+    ++g_skippedStateCallCount;
     return true;
   }
-  std::lock_guard guard{g_pipelineMutex};
   const auto it = g_pipelines.find(ref);
   if (it == g_pipelines.end()) {
     return false;
   }
   pass.SetPipeline(it->second);
-  g_currentPipeline = ref;
+  g_passState.pipeline = ref;
+  ++g_stateCallCount;
   return true;
 }
 
-static inline Range push(ByteBuffer& target, const uint8_t* data, size_t length, size_t alignment) {
+void bind_group(u32 index, BindGroupRef id, ArrayRef<u32> offsets, const wgpu::RenderPassEncoder& pass) {
+  CHECK(index < MaxBindGroups && offsets.size() <= MaxDynamicOffsets, "Invalid bind group {} ({} offsets)", index,
+        offsets.size());
+  auto& bound = g_passState.bindGroups[index];
+  if (bound.id == id && bound.offsetCount == offsets.size() &&
+      std::equal(offsets.begin(), offsets.end(), bound.offsets.begin())) {
+    ++g_skippedStateCallCount;
+    return;
+  }
+  pass.SetBindGroup(index, find_bind_group(id), offsets.size(), offsets.data());
+  bound.id = id;
+  bound.offsetCount = offsets.size();
+  std::copy(offsets.begin(), offsets.end(), bound.offsets.begin());
+  ++g_stateCallCount;
+}
+
+void bind_vertex_buffer(Range range, const wgpu::RenderPassEncoder& pass) {
+  if (range == g_passState.vertexBuffer) {
+    ++g_skippedStateCallCount;
+    return;
+  }
+  const auto& buffer =
+      is_resident(range) ? resident_buffer(g_residentVertexPool, range.chunk) : g_vertexRing.chunks[range.chunk].buffer;
+  pass.SetVertexBuffer(0, buffer, range.offset, range.size);
+  g_passState.vertexBuffer = range;
+  ++g_stateCallCount;
+}
+
+void bind_index_buffer(Range range, wgpu::IndexFormat format, const wgpu::RenderPassEncoder& pass) {
+  if (range == g_passState.indexBuffer && format == g_passState.indexFormat) {
+    ++g_skippedStateCallCount;
+    return;
+  }
+  const auto& buffer =
+      is_resident(range) ? resident_buffer(g_residentIndexPool, range.chunk) : g_indexRing.chunks[range.chunk].buffer;
+  pass.SetIndexBuffer(buffer, format, range.offset, range.size);
+  g_passState.indexBuffer = range;
+  g_passState.indexFormat = format;
+  ++g_stateCallCount;
+}
+
+void set_blend_constant(const wgpu::Color& color, const wgpu::RenderPassEncoder& pass) {
+  const auto& bound = g_passState.blendConstant;
+  if (bound && bound->r == color.r && bound->g == color.g && bound->b == color.b && bound->a == color.a) {
+    ++g_skippedStateCallCount;
+    return;
+  }
+  pass.SetBlendConstant(&color);
+  g_passState.blendConstant = color;
+  ++g_stateCallCount;
+}
+
+// Padding that places the next range in the ring's current chunk at a multiple of alignment. Rings mix alignments
+// (see map_array_element), so the end of the last range can't be assumed to be aligned.
+static inline size_t leading_padding(const BufferRing& ring, size_t alignment) {
+  if (alignment == 0 || ring.current >= ring.chunks.size()) {
+    return 0;
+  }
+  const auto size = ring.chunks[ring.current].data.size();
+  return (alignment - size % alignment) % alignment;
+}
+static inline Range push(BufferRing& ring, const uint8_t* data, size_t length, size_t alignment) {
   size_t padding = 0;
   if (alignment != 0) {
-    padding = alignment - length % alignment;
+    padding = (alignment - length % alignment) % alignment;
   }
-  auto begin = target.size();
+  const u32 chunk =
+      reserve_buffer_chunk(ring, leading_padding(ring, alignment) + (length == 0 ? alignment : length) + padding);
+  auto& target = ring.chunks[chunk].data;
+  const auto end = target.size();
+  if (const auto leading = leading_padding(ring, alignment); leading > 0) {
+    target.append_zeroes(leading);
+  }
+  const auto begin = target.size();
   if (length == 0) {
     length = alignment;
     target.append_zeroes(alignment);
@@ -723,33 +1697,165 @@ static inline Range push(ByteBuffer& target, const uint8_t* data, size_t length,
       target.append_zeroes(padding);
     }
   }
-  return {static_cast<uint32_t>(begin), static_cast<uint32_t>(length + padding)};
+  ring.used += target.size() - end;
+  return {static_cast<uint32_t>(begin), static_cast<uint32_t>(length + padding), chunk};
 }
-static inline Range map(ByteBuffer& target, size_t length, size_t alignment) {
+static inline Range map(BufferRing& ring, size_t length, size_t alignment) {
   size_t padding = 0;
   if (alignment != 0) {
-    padding = alignment - length % alignment;
+    padding = (alignment - length % alignment) % alignment;
   }
   if (length == 0) {
     length = alignment;
   }
-  auto begin = target.size();
-  target.append_zeroes(length + padding);
-  return {static_cast<uint32_t>(begin), static_cast<uint32_t>(length + padding)};
+  const u32 chunk = reserve_buffer_chunk(ring, leading_padding(ring, alignment) + length + padding);
+  auto& target = ring.chunks[chunk].data;
+  const auto end = target.size();
+  const auto begin = end + leading_padding(ring, alignment);
+  target.append_zeroes(begin - end + length + padding);
+  ring.used += target.size() - end;
+  return {static_cast<uint32_t>(begin), static_cast<uint32_t>(length + padding), chunk};
+}
+// Maps stride bytes at a multiple of stride, so offset / stride indexes an array<T> with that stride
+static inline Range map_array_element(BufferRing& ring, size_t stride) {
+  const u32 chunk = reserve_buffer_chunk(ring, leading_padding(ring, stride) + stride);
+  auto& target = ring.chunks[chunk].data;
+  const auto end = target.size();
+  const auto begin = end + leading_padding(ring, stride);
+  target.append_zeroes(begin + stride - end);
+  ring.used += target.size() - end;
+  return {static_cast<uint32_t>(begin), static_cast<uint32_t>(stride), chunk};
 }
-Range push_verts(const uint8_t* data, size_t length) { return push(g_verts, data, length, 0); }
-Range push_indices(const uint8_t* data, size_t length) { return push(g_indices, data, length, 0); }
+Range push_verts(const uint8_t* data, size_t length) { return push(g_vertexRing, data, length, 0); }
+Range push_indices(const uint8_t* data, size_t length) { return push(g_indexRing, data, length, 0); }
 Range push_uniform(const uint8_t* data, size_t length) {
-  return push(g_uniforms, data, length, g_cachedLimits.limits.minUniformBufferOffsetAlignment);
+  return push(g_uniformRing, data, length, g_cachedLimits.limits.minUniformBufferOffsetAlignment);
 }
 Range push_storage(const uint8_t* data, size_t length) {
-  return push(g_storage, data, length, g_cachedLimits.limits.minStorageBufferOffsetAlignment);
+  return push(g_storageRing, data, length, g_cachedLimits.limits.minStorageBufferOffsetAlignment);
+}
+// Range sizes are padded to 4 bytes, as storage bindings require. offsetAlignment is a multiple of the pool's
+// alignment, but not necessarily a power of two.
+static std::optional<Range> allocate_resident_range(ResidentPool& pool, uint64_t length, uint64_t offsetAlignment) {
+  const uint64_t size = ALIGN(length, pool.alignment);
+  const auto rangeSize = static_cast<u32>(ALIGN(length, 4));
+  for (u32 i = 0; i < pool.blocks.size(); ++i) {
+    auto& free = pool.blocks[i].free;
+    for (auto it = free.begin(); it != free.end(); ++it) {
+      const auto [freeOffset, freeSize] = *it;
+      const uint64_t offset = (freeOffset + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+      if (offset + size > freeOffset + freeSize) {
+        continue;
+      }
+      free.erase(it);
+      if (offset > freeOffset) {
+        free.emplace(freeOffset, offset - freeOffset);
+      }
+      if (freeOffset + freeSize > offset + size) {
+        free.emplace(offset + size, freeOffset + freeSize - (offset + size));
+      }
+      pool.used += size;
+      return Range{static_cast<u32>(offset), rangeSize, i | ResidentChunkFlag};
+    }
+  }
+  const uint64_t blockSize = std::max(pool.blockSize, size);
+  if (blockSize > pool.maxBlockSize) {
+    return std::nullopt;
+  }
+  auto it = std::ranges::find_if(pool.blocks, [](const ResidentBlock& block) { return !block.buffer; });
+  if (it == pool.blocks.end()) {
+    it = pool.blocks.insert(it, ResidentBlock{});
+  }
+  const auto idx = static_cast<u32>(it - pool.blocks.begin());
+  it->buffer =
+      create_buffer(pool.usage, blockSize, fmt::format(FMT_STRING("Resident {} Buffer {}"), pool.label, idx));
+  it->size = blockSize;
+  if (blockSize > size) {
+    it->free.emplace(size, blockSize - size);
+  }
+  pool.used += size;
+  return Range{0, rangeSize, idx | ResidentChunkFlag};
+}
+static void write_resident_range(const ResidentPool& pool, const Range& range, const uint8_t* data, size_t length) {
+  // WriteBuffer needs a multiple of 4 bytes
+  const auto& buffer = resident_buffer(pool, range.chunk);
+  const size_t alignedLength = length & ~size_t{3};
+  g_queue.WriteBuffer(buffer, range.offset, data, alignedLength);
+  if (alignedLength != length) {
+    std::array<u8, 4> tail{};
+    memcpy(tail.data(), data + alignedLength, length - alignedLength);
+    g_queue.WriteBuffer(buffer, range.offset + alignedLength, tail.data(), tail.size());
+  }
+  g_residentUploadSize += length;
+}
+Range push_vertex_array(const uint8_t* data, size_t length) {
+  const auto hash = xxh3_hash_s(data, length, length);
+  if (const auto it = g_residentArrays.find(hash); it != g_residentArrays.end()) {
+    it->second.lastUsedFrame = g_frameIndex;
+    return it->second.range;
+  }
+  if (const auto range = allocate_resident_range(g_residentArrayPool, length, g_residentArrayPool.alignment)) {
+    write_resident_range(g_residentArrayPool, *range, data, length);
+    g_residentArrays.try_emplace(hash, ResidentRange{*range, g_frameIndex});
+    return *range;
+  }
+  return push_storage(data, length);
+}
+std::pair<Range, Range> push_display_list(HashType key, ArrayRef<uint8_t> verts, ArrayRef<uint8_t> indices,
+                                          u32 vtxCount) {
+  if (const auto it = g_residentDisplayLists.find(key); it != g_residentDisplayLists.end()) {
+    it->second.lastUsedFrame = g_frameIndex;
+    return {it->second.vertBinding, it->second.idxRange};
+  }
+  const size_t indexCount = indices.size() / sizeof(u16);
+  const u32 stride = vtxCount != 0 ? verts.size() / vtxCount : 0;
+  std::optional<Range> vertRange;
+  std::optional<Range> idxRange;
+  if (stride != 0 && indexCount != 0) {
+    // Vertices start at a multiple of their stride, so they can be indexed from the start of the block
+    vertRange = allocate_resident_range(g_residentVertexPool, verts.size(),
+                                        std::lcm(uint64_t{stride}, g_residentVertexPool.alignment));
+    idxRange = allocate_resident_range(g_residentIndexPool, indexCount * sizeof(u32), g_residentIndexPool.alignment);
+  }
+  if (!vertRange || !idxRange) {
+    if (vertRange) {
+      free_resident_range(g_residentVertexPool, *vertRange);
+    }
+    if (idxRange) {
+      free_resident_range(g_residentIndexPool, *idxRange);
+    }
+    return {push_verts(verts.data(), verts.size()), push_indices(indices.data(), indices.size())};
+  }
+  write_resident_range(g_residentVertexPool, *vertRange, verts.data(), verts.size());
+  // Vertices directly following the last upload's (up to alignment) extend its run's binding, otherwise they start a
+  // new one. Indices are widened & rebased onto the run, so display lists uploaded back to back merge by extending
+  // their index range.
+  auto& run = g_displayListRun;
+  const uint64_t alignment = std::lcm(uint64_t{stride}, g_residentVertexPool.alignment);
+  const uint64_t runEnd = uint64_t{run.binding.offset} + run.binding.size;
+  if (run.binding.size == 0 || run.binding.chunk != vertRange->chunk || run.stride != stride ||
+      vertRange->offset != (runEnd + alignment - 1) / alignment * alignment) {
+    run = {*vertRange, stride};
+  }
+  run.binding.size = vertRange->offset + vertRange->size - run.binding.offset;
+  const u32 baseVertex = (vertRange->offset - run.binding.offset) / stride;
+  static std::vector<u32> sWideIndices;
+  sWideIndices.resize(indexCount);
+  for (size_t i = 0; i < indexCount; ++i) {
+    u16 index;
+    memcpy(&index, indices.data() + i * sizeof(u16), sizeof(index));
+    sWideIndices[i] = index + baseVertex;
+  }
+  write_resident_range(g_residentIndexPool, *idxRange, reinterpret_cast<const u8*>(sWideIndices.data()),
+                       indexCount * sizeof(u32));
+  g_residentDisplayLists.try_emplace(key, ResidentDisplayList{*vertRange, run.binding, *idxRange, g_frameIndex});
+  return {run.binding, *idxRange};
 }
 Range push_texture_data(const uint8_t* data, size_t length, u32 bytesPerRow, u32 rowsPerImage) {
   // For CopyBufferToTexture, we need an alignment of 256 per row (see Dawn kTextureBytesPerRowAlignment)
   const auto copyBytesPerRow = ALIGN(bytesPerRow, 256);
-  const auto range = map(g_textureUpload, copyBytesPerRow * rowsPerImage, 0);
-  u8* dst = g_textureUpload.data() + range.offset;
+  const auto range = map(g_textureUploadRing, copyBytesPerRow * rowsPerImage, 0);
+  u8* dst = buffer_data(g_textureUploadRing, range);
   for (u32 i = 0; i < rowsPerImage; ++i) {
     memcpy(dst, data, bytesPerRow);
     data += bytesPerRow;
@@ -758,44 +1864,112 @@ Range push_texture_data(const uint8_t* data, size_t length, u32 bytesPerRow, u32
   return range;
 }
 std::pair<ByteBuffer, Range> map_verts(size_t length) {
-  const auto range = map(g_verts, length, 4);
-  return {ByteBuffer{g_verts.data() + range.offset, range.size}, range};
+  const auto range = map(g_vertexRing, length, 4);
+  return {ByteBuffer{buffer_data(g_vertexRing, range), range.size}, range};
 }
 std::pair<ByteBuffer, Range> map_indices(size_t length) {
-  const auto range = map(g_indices, length, 4);
-  return {ByteBuffer{g_indices.data() + range.offset, range.size}, range};
+  const auto range = map(g_indexRing, length, 4);
+  return {ByteBuffer{buffer_data(g_indexRing, range), range.size}, range};
 }
 std::pair<ByteBuffer, Range> map_uniform(size_t length) {
-  const auto range = map(g_uniforms, length, g_cachedLimits.limits.minUniformBufferOffsetAlignment);
-  return {ByteBuffer{g_uniforms.data() + range.offset, range.size}, range};
+  const auto range = map(g_uniformRing, length, g_cachedLimits.limits.minUniformBufferOffsetAlignment);
+  return {ByteBuffer{buffer_data(g_uniformRing, range), range.size}, range};
+}
+UniformRanges push_draw_uniforms(ArrayRef<uint8_t> draw, ArrayRef<uint8_t> frame, ArrayRef<uint8_t> material,
+                                 bool perDrawStorage) {
+  const size_t alignment = g_cachedLimits.limits.minUniformBufferOffsetAlignment;
+  // Reserve room for all blocks with worst case padding, so that they share a chunk (and a bind group)
+  const u32 chunk = reserve_buffer_chunk(g_uniformRing, (perDrawStorage ? draw.size() * 2 : draw.size() + alignment * 2) +
+                                                             frame.size() + material.size() + alignment * 4);
+  // Frame & material blocks unchanged since last frame move to resident buffers, and aren't pushed again
+  const auto pushBlock = [&](ArrayRef<uint8_t> data, bool storage, bool resident) -> Range {
+    if (data.empty()) {
+      return {};
+    }
+    const auto hash = xxh3_hash_s(data.data(), data.size(), storage);
+    if (resident) {
+      if (const auto it = g_residentUniforms.find(hash); it != g_residentUniforms.end()) {
+        it->second.lastUsedFrame = g_frameIndex;
+        g_dedupedUniformSize += data.size();
+        return it->second.range;
+      }
+    }
+    if (const auto it = g_drawUniforms.find(hash); it != g_drawUniforms.end() && it->second.chunk == chunk) {
+      g_dedupedUniformSize += data.size();
+      return it->second;
+    }
+    if (resident && g_lastDrawUniforms.contains(hash)) {
+      const auto range = allocate_resident_range(g_residentUniformPool, data.size(), g_residentUniformPool.alignment);
+      if (range) {
+        write_resident_range(g_residentUniformPool, *range, data.data(), data.size());
+        g_residentUniforms.try_emplace(hash, ResidentRange{*range, g_frameIndex});
+        return *range;
+      }
+    }
+    Range range;
+    if (storage) {
+      range = map_array_element(g_uniformRing, data.size());
+      memcpy(buffer_data(g_uniformRing, range), data.data(), data.size());
+    } else {
+      range = push_uniform(data.data(), data.size());
+    }
+    g_drawUniforms.insert_or_assign(hash, range);
+    return range;
+  };
+  return {
+      .draw = pushBlock(draw, perDrawStorage, false),
+      .frame = pushBlock(frame, false, true),
+      .material = pushBlock(material, false, true),
+  };
 }
 std::pair<ByteBuffer, Range> map_storage(size_t length) {
-  const auto range = map(g_storage, length, g_cachedLimits.limits.minStorageBufferOffsetAlignment);
-  return {ByteBuffer{g_storage.data() + range.offset, range.size}, range};
+  const auto range = map(g_storageRing, length, g_cachedLimits.limits.minStorageBufferOffsetAlignment);
+  return {ByteBuffer{buffer_data(g_storageRing, range), range.size}, range};
+}
+
+static CachedBindGroup create_bind_group(const wgpu::BindGroupDescriptor& descriptor) {
+  CachedBindGroup entry{
+      .bindGroup = g_device.CreateBindGroup(&descriptor),
+      .lastUsedFrame = g_frameIndex,
+  };
+  for (size_t i = 0; i < descriptor.entryCount; ++i) {
+    if (const auto& view = descriptor.entries[i].textureView) {
+      entry.textureViews.push_back(view.Get());
+    }
+  }
+  return entry;
 }
 
-// TODO: should we avoid caching bind groups altogether?
 BindGroupRef bind_group_ref(const wgpu::BindGroupDescriptor& descriptor) {
 #ifdef EMSCRIPTEN
-  const auto bg = g_device.CreateBindGroup(&descriptor);
-  BindGroupRef id = reinterpret_cast<BindGroupRef>(bg.Get());
-  g_cachedBindGroups.try_emplace(id, bg);
+  auto entry = create_bind_group(descriptor);
+  BindGroupRef id = reinterpret_cast<BindGroupRef>(entry.bindGroup.Get());
+  g_cachedBindGroups.try_emplace(id, std::move(entry));
+  ++g_bindGroupMisses;
 #else
   const auto id = xxh3_hash(descriptor);
-  if (!g_cachedBindGroups.contains(id)) {
-    g_cachedBindGroups.try_emplace(id, g_device.CreateBindGroup(&descriptor));
+  if (const auto it = g_cachedBindGroups.find(id); it != g_cachedBindGroups.end()) {
+    it->second.lastUsedFrame = g_frameIndex;
+    ++g_bindGroupHits;
+  } else {
+    g_cachedBindGroups.try_emplace(id, create_bind_group(descriptor));
+    ++g_bindGroupMisses;
   }
 #endif
   return id;
 }
 const wgpu::BindGroup& find_bind_group(BindGroupRef id) {
-#ifdef EMSCRIPTEN
-  return g_cachedBindGroups[id];
-#else
   const auto it = g_cachedBindGroups.find(id);
   CHECK(it != g_cachedBindGroups.end(), "get_bind_group: failed to locate {:x}", id);
-  return it->second;
-#endif
+  // Draws reusing the last draw's bind groups don't go through bind_group_ref
+  it->second.lastUsedFrame = g_frameIndex;
+  return it->second.bindGroup;
+}
+
+void release_bind_groups(const wgpu::TextureView& view) {
+  if (g_bindGroupCacheActive && view) {
+    g_releasedTextureViews.insert(view.Get());
+  }
 }
 
 const wgpu::Sampler& sampler_ref(const wgpu::SamplerDescriptor& descriptor) {
@@ -810,13 +1984,48 @@ const wgpu::Sampler& sampler_ref(const wgpu::SamplerDescriptor& descriptor) {
 uint32_t align_uniform(uint32_t value) { return ALIGN(value, g_cachedLimits.limits.minUniformBufferOffsetAlignment); }
 } // namespace aurora::gfx
 
+void aurora_begin_pipeline_tag(const char* name) { aurora::gfx::pipeline_cache::begin_tag(name); }
+void aurora_end_pipeline_tag() { aurora::gfx::pipeline_cache::end_tag(); }
+uint32_t aurora_precompile_tag(const char* name) {
+  using namespace aurora::gfx;
+  return pipeline_cache::precompile_tag(name, [](ShaderType type, const u8* data, u32 size) {
+    enqueue_cached_pipeline(type, data, size, PipelinePriority::Precompile);
+  });
+}
+float aurora_pipeline_tag_progress(const char* name) { return aurora::gfx::pipeline_cache::tag_progress(name); }
+float aurora_get_gpu_wait_ms() {
+  return std::chrono::duration<float, std::milli>(aurora::gfx::g_lastGpuWaitTime).count();
+}
+void aurora_get_buffer_stats(AuroraBufferStats stats[BUFFER_CATEGORY_COUNT]) {
+  using namespace aurora::gfx;
+  for (size_t i = 0; i < g_bufferRings.size(); ++i) {
+    const auto& ring = *g_bufferRings[i];
+    auto& out = stats[i];
+    out = {};
+    for (const auto& chunk : ring.chunks) {
+      if (chunk.buffer) {
+        out.reserved += chunk.size;
+      }
+      for (const auto& staging : chunk.staging) {
+        if (staging) {
+          out.reservedStaging += chunk.size;
+        }
+      }
+    }
+    out.used = ring.lastUsed;
+    out.highWater = ring.sessionHighWater;
+  }
+}
+
 void push_debug_group(const char* label) {
 #ifdef AURORA_GFX_DEBUG_GROUPS
   aurora::gfx::g_debugGroupStack.emplace_back(label);
+  aurora::gfx::g_debugGroupsChanged = true;
 #endif
 }
 void pop_debug_group() {
 #ifdef AURORA_GFX_DEBUG_GROUPS
   aurora::gfx::g_debugGroupStack.pop_back();
+  aurora::gfx::g_debugGroupsChanged = true;
 #endif
 }
@@ -124,11 +124,6 @@ private:
 } // namespace aurora
 
 namespace aurora::gfx {
-extern wgpu::Buffer g_vertexBuffer;
-extern wgpu::Buffer g_uniformBuffer;
-extern wgpu::Buffer g_indexBuffer;
-extern wgpu::Buffer g_storageBuffer;
-
 using BindGroupRef = HashType;
 using PipelineRef = HashType;
 using SamplerRef = HashType;
@@ -136,10 +131,17 @@ using ShaderRef = HashType;
 struct Range {
   uint32_t offset = 0;
   uint32_t size = 0;
+  uint32_t chunk = 0; // Buffer chunk the range was pushed to
 
   bool operator==(const Range& rhs) const { return memcmp(this, &rhs, sizeof(*this)) == 0; }
   bool operator!=(const Range& rhs) const { return !(*this == rhs); }
 };
+// A draw's uniform blocks by update frequency, in binding order. Ubershaders only use draw; empty blocks are unbound.
+struct UniformRanges {
+  Range draw;     // Position, normal & texture matrices
+  Range frame;    // Projection, lights & fog
+  Range material; // TEV registers, channel & konst colors, texture LOD biases
+};
 
 struct ClipRect {
   int32_t x;
@@ -162,6 +164,9 @@ enum class ShaderType {
 void initialize();
 void shutdown();
 
+// Whether the next frame's staging buffers are free, waiting for the GPU if wait is set
+bool frame_ready(bool wait);
+// Requires frame_ready to have returned true
 void begin_frame();
 void end_frame(const wgpu::CommandEncoder& cmd);
 void render(wgpu::CommandEncoder& cmd);
@@ -193,25 +198,48 @@ template <typename T>
 static inline Range push_storage(const T& data) {
   return push_storage(reinterpret_cast<const uint8_t*>(&data), sizeof(T));
 }
+// Storage range of vertex array data, keyed by its contents and uploaded once to a resident buffer. Callers cache
+// the range until the array changes (see AttrArray::cachedRange); ranges that aren't resident only last the frame.
+Range push_vertex_array(const uint8_t* data, size_t length);
+// Vertex & index ranges of converted display list geometry (u16 indices), uploaded once to resident buffers under
+// key. Resident ranges bind the vertices of display lists uploaded back to back with the same stride, drawn with u32
+// indices. Least recently used geometry is evicted past AuroraConfig::displayListCacheSize.
+std::pair<Range, Range> push_display_list(HashType key, ArrayRef<uint8_t> verts, ArrayRef<uint8_t> indices,
+                                          uint32_t vtxCount);
 Range push_texture_data(const uint8_t* data, size_t length, uint32_t bytesPerRow, uint32_t rowsPerImage);
 std::pair<ByteBuffer, Range> map_verts(size_t length);
 std::pair<ByteBuffer, Range> map_indices(size_t length);
 std::pair<ByteBuffer, Range> map_uniform(size_t length);
+// Pushes a draw's uniform blocks to one chunk, reusing the ranges of identical blocks pushed earlier this frame.
+// With perDrawStorage, the draw block is placed at a multiple of its length (see ShaderInfo::perDrawStorage).
+UniformRanges push_draw_uniforms(ArrayRef<uint8_t> draw, ArrayRef<uint8_t> frame, ArrayRef<uint8_t> material,
+                                 bool perDrawStorage);
 std::pair<ByteBuffer, Range> map_storage(size_t length);
+const wgpu::Buffer& uniform_buffer(uint32_t chunk);
+const wgpu::Buffer& storage_buffer(uint32_t chunk);
 
 template <typename State>
 const State& get_state();
 template <typename DrawData>
 void push_draw_command(DrawData data);
+// Extends the last draw command; returns false if data can't be merged into it
 template <typename DrawData>
-void merge_draw_command(DrawData data);
+bool merge_draw_command(DrawData data);
 
 template <typename PipelineConfig>
 PipelineRef pipeline_ref(PipelineConfig config);
+bool pipeline_ready(PipelineRef ref);
+// Render pass state setters, skipping calls that match the pass' current state
 bool bind_pipeline(PipelineRef ref, const wgpu::RenderPassEncoder& pass);
+void bind_group(uint32_t index, BindGroupRef id, ArrayRef<uint32_t> offsets, const wgpu::RenderPassEncoder& pass);
+void bind_vertex_buffer(Range range, const wgpu::RenderPassEncoder& pass);
+void bind_index_buffer(Range range, wgpu::IndexFormat format, const wgpu::RenderPassEncoder& pass);
+void set_blend_constant(const wgpu::Color& color, const wgpu::RenderPassEncoder& pass);
 
 BindGroupRef bind_group_ref(const wgpu::BindGroupDescriptor& descriptor);
 const wgpu::BindGroup& find_bind_group(BindGroupRef id);
+// Drops cached bind groups referencing the view at the start of the next frame
+void release_bind_groups(const wgpu::TextureView& view);
 
 const wgpu::Sampler& sampler_ref(const wgpu::SamplerDescriptor& descriptor);
 
@@ -6,8 +6,13 @@
 #include "common.hpp"
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cfloat>
 #include <cmath>
+#include <mutex>
 
 using aurora::gfx::gx::g_gxState;
 static aurora::Module Log("aurora::gx");
@@ -20,6 +25,7 @@ using webgpu::g_device;
 using webgpu::g_graphicsConfig;
 
 GXState g_gxState{};
+std::optional<ResolvedDraw> g_lastDraw;
 
 const TextureBind& get_texture(GXTexMapID id) noexcept { return g_gxState.textures[static_cast<size_t>(id)]; }
 
@@ -215,21 +221,10 @@ wgpu::RenderPipeline build_pipeline(const PipelineConfig& config, const ShaderIn
       .targetCount = colorTargets.size(),
       .targets = colorTargets.data(),
   };
-  auto layouts = build_bind_group_layouts(info, config.shaderConfig);
-  const std::array bindGroupLayouts{
-      layouts.uniformLayout,
-      layouts.samplerLayout,
-      layouts.textureLayout,
-  };
-  const wgpu::PipelineLayoutDescriptor pipelineLayoutDescriptor{
-      .label = "GX Pipeline Layout",
-      .bindGroupLayoutCount = static_cast<uint32_t>(info.sampledTextures.any() ? bindGroupLayouts.size() : 1),
-      .bindGroupLayouts = bindGroupLayouts.data(),
-  };
-  auto pipelineLayout = g_device.CreatePipelineLayout(&pipelineLayoutDescriptor);
+  const auto layouts = build_bind_group_layouts(info, config.shaderConfig);
   const wgpu::RenderPipelineDescriptor descriptor{
       .label = label,
-      .layout = pipelineLayout,
+      .layout = layouts.pipelineLayout,
       .vertex =
           {
               .module = shader,
@@ -249,6 +244,23 @@ wgpu::RenderPipeline build_pipeline(const PipelineConfig& config, const ShaderIn
   return g_device.CreateRenderPipeline(&descriptor);
 }
 
+#ifndef NDEBUG
+// Distinct shader configs before & after canonicalization, logged at shutdown
+static absl::flat_hash_set<ShaderRef> sRawShaderConfigs;
+static absl::flat_hash_set<ShaderRef> sCanonicalShaderConfigs;
+#endif
+
+// Lights in the mask of any lit channel
+static GX::LightMask lit_lights(const ShaderConfig& config) noexcept {
+  GX::LightMask mask;
+  for (u32 i = 0; i < config.colorChannels.size(); ++i) {
+    if (config.colorChannels[i].lightingEnabled) {
+      mask |= g_gxState.colorChannelState[i].lightMask;
+    }
+  }
+  return mask;
+}
+
 void populate_pipeline_config(PipelineConfig& config, GXPrimitive primitive) noexcept {
   config.shaderConfig.fogType = g_gxState.fog.type;
   config.shaderConfig.vtxAttrs = g_gxState.vtxDesc;
@@ -275,15 +287,7 @@ void populate_pipeline_config(PipelineConfig& config, GXPrimitive primitive) noe
   }
   config.shaderConfig.tevStageCount = g_gxState.numTevStages;
   for (u8 i = 0; i < g_gxState.numChans * 2; ++i) {
-    const auto& cc = g_gxState.colorChannelConfig[i];
-    if (cc.lightingEnabled) {
-      config.shaderConfig.colorChannels[i] = cc;
-    } else {
-      // Only matSrc matters when lighting disabled
-      config.shaderConfig.colorChannels[i] = {
-          .matSrc = cc.matSrc,
-      };
-    }
+    config.shaderConfig.colorChannels[i] = g_gxState.colorChannelConfig[i];
   }
   for (u8 i = 0; i < g_gxState.numTexGens; ++i) {
     config.shaderConfig.tcgs[i] = g_gxState.tcgs[i];
@@ -308,6 +312,17 @@ void populate_pipeline_config(PipelineConfig& config, GXPrimitive primitive) noe
     }
     config.shaderConfig.textureConfig[i] = texConfig;
   }
+#ifndef NDEBUG
+  sRawShaderConfigs.insert(xxh3_hash(config.shaderConfig));
+#endif
+  canonicalize_shader_config(config.shaderConfig);
+  if (std::ranges::any_of(config.shaderConfig.colorChannels, [](const auto& cc) { return cc.lightingEnabled; })) {
+    // Rounded up so that light masks changing between draws rarely need another pipeline
+    config.shaderConfig.lightCount = std::bit_ceil(std::max<size_t>(lit_lights(config.shaderConfig).count(), 1));
+  }
+#ifndef NDEBUG
+  sCanonicalShaderConfigs.insert(xxh3_hash(config.shaderConfig));
+#endif
   config = {
       .shaderConfig = config.shaderConfig,
       .primitive = primitive,
@@ -325,39 +340,240 @@ void populate_pipeline_config(PipelineConfig& config, GXPrimitive primitive) noe
   };
 }
 
-Range build_uniform(const ShaderInfo& info) noexcept {
-  auto [buf, range] = map_uniform(info.uniformSize);
-  {
-    buf.append(&g_gxState.pnMtx[g_gxState.currentPnMtx], 128);
-    buf.append(&g_gxState.proj, 64);
+namespace {
+class KeyWriter {
+public:
+  explicit KeyWriter(PipelineKey& key) : m_bits(key.bits) {}
+
+  template <typename T>
+  void field(const T& value, u32 bits) noexcept {
+    write(static_cast<u64>(value), bits);
+  }
+  // Encodes null as all ones, so the remaining values fit in fewer bits
+  template <typename T>
+  void nullable(const T& value, u32 bits, T null) noexcept {
+    write(value == null ? (u64{1} << bits) - 1 : static_cast<u64>(value), bits);
+  }
+
+private:
+  void write(u64 value, u32 bits) noexcept {
+#ifndef NDEBUG
+    CHECK(value < (u64{1} << bits), "Pipeline key field overflow: {} in {} bits", value, bits);
+    CHECK(m_pos + bits <= m_bits.size() * 64, "Pipeline key overflow");
+#endif
+    const u32 word = m_pos / 64;
+    const u32 shift = m_pos % 64;
+    m_bits[word] |= value << shift;
+    if (shift + bits > 64) {
+      m_bits[word + 1] |= value >> (64 - shift);
+    }
+    m_pos += bits;
+  }
+
+  std::array<u64, PipelineKeyWords>& m_bits;
+  u32 m_pos = 0;
+};
+
+class KeyReader {
+public:
+  explicit KeyReader(const PipelineKey& key) : m_bits(key.bits) {}
+
+  template <typename T>
+  void field(T& value, u32 bits) noexcept {
+    value = static_cast<T>(read(bits));
+  }
+  template <typename T>
+  void nullable(T& value, u32 bits, T null) noexcept {
+    const u64 raw = read(bits);
+    value = raw == (u64{1} << bits) - 1 ? null : static_cast<T>(raw);
+  }
+
+private:
+  u64 read(u32 bits) noexcept {
+    const u32 word = m_pos / 64;
+    const u32 shift = m_pos % 64;
+    u64 value = m_bits[word] >> shift;
+    if (shift + bits > 64) {
+      value |= m_bits[word + 1] << (64 - shift);
+    }
+    m_pos += bits;
+    return value & ((u64{1} << bits) - 1);
+  }
+
+  const std::array<u64, PipelineKeyWords>& m_bits;
+  u32 m_pos = 0;
+};
+
+// Field order & widths of PipelineKey, shared by packing and unpacking.
+// Widths cover the largest value of each GX enum; CHECKed in debug builds.
+template <typename Stream, typename Config>
+void visit_pipeline_key(Stream& s, Config& config) noexcept {
+  auto& sc = config.shaderConfig;
+  s.field(sc.fogType, 4);
+  for (auto& type : sc.vtxAttrs) {
+    s.field(type, 2);
+  }
+  for (auto& attr : sc.attrMapping) {
+    s.nullable(attr, 5, GX_VA_NULL);
+  }
+  for (auto& swap : sc.tevSwapTable) {
+    s.field(swap.red, 2);
+    s.field(swap.green, 2);
+    s.field(swap.blue, 2);
+    s.field(swap.alpha, 2);
+  }
+  // Stages past tevStageCount are left at their defaults by canonicalize_shader_config
+  s.field(sc.tevStageCount, 5);
+  for (u32 i = 0; i < sc.tevStageCount; ++i) {
+    auto& stage = sc.tevStages[i];
+    s.field(stage.colorPass.a, 4);
+    s.field(stage.colorPass.b, 4);
+    s.field(stage.colorPass.c, 4);
+    s.field(stage.colorPass.d, 4);
+    s.field(stage.alphaPass.a, 3);
+    s.field(stage.alphaPass.b, 3);
+    s.field(stage.alphaPass.c, 3);
+    s.field(stage.alphaPass.d, 3);
+    for (auto* op : {&stage.colorOp, &stage.alphaOp}) {
+      s.field(op->op, 4);
+      s.field(op->bias, 2);
+      s.field(op->scale, 2);
+      s.field(op->outReg, 2);
+      s.field(op->clamp, 1);
+    }
+    s.field(stage.kcSel, 5);
+    s.field(stage.kaSel, 5);
+    s.nullable(stage.texCoordId, 4, GX_TEXCOORD_NULL);
+    s.field(stage.texMapId, 9); // GX_TEXMAP_NULL, GX_TEX_DISABLE flag
+    s.nullable(stage.channelId, 4, GX_COLOR_NULL);
+    s.field(stage.tevSwapRas, 2);
+    s.field(stage.tevSwapTex, 2);
+    s.field(stage.indTexStage, 2);
+    s.field(stage.indTexFormat, 2);
+    s.field(stage.indTexBiasSel, 3);
+    s.field(stage.indTexAlphaSel, 2);
+    s.field(stage.indTexMtxId, 4);
+    s.field(stage.indTexWrapS, 3);
+    s.field(stage.indTexWrapT, 3);
+    s.field(stage.indTexUseOrigLOD, 1);
+    s.field(stage.indTexAddPrev, 1);
+  }
+  for (auto& cc : sc.colorChannels) {
+    s.field(cc.matSrc, 1);
+    s.field(cc.ambSrc, 1);
+    s.field(cc.diffFn, 2);
+    s.field(cc.attnFn, 2);
+    s.field(cc.lightingEnabled, 1);
+  }
+  for (auto& tcg : sc.tcgs) {
+    s.field(tcg.type, 4);
+    s.field(tcg.src, 5);
+    s.field(tcg.mtx, 6);
+    s.field(tcg.postMtx, 7);
+    s.field(tcg.normalize, 1);
+  }
+  s.field(sc.alphaCompare.comp0, 3);
+  s.field(sc.alphaCompare.ref0, 8);
+  s.field(sc.alphaCompare.op, 2);
+  s.field(sc.alphaCompare.comp1, 3);
+  s.field(sc.alphaCompare.ref1, 8);
+  s.field(sc.indexedAttributeCount, 5);
+  for (auto& tex : sc.textureConfig) {
+    s.nullable(tex.copyFmt, 7, InvalidTextureFormat);
+    s.nullable(tex.loadFmt, 7, InvalidTextureFormat);
+    s.field(tex.renderTex, 1);
   }
+  s.field(sc.ubershader, 1);
+  s.field(sc.sampledTextures, 8);
+  s.field(sc.lightCount, 4);
+  s.field(config.primitive, 8);
+  s.field(config.depthFunc, 3);
+  s.field(config.cullMode, 2);
+  s.field(config.blendMode, 2);
+  s.field(config.blendFacSrc, 3);
+  s.field(config.blendFacDst, 3);
+  s.field(config.blendOp, 4);
+  s.nullable(config.dstAlpha, 9, UINT32_MAX);
+  s.field(config.depthCompare, 1);
+  s.field(config.depthUpdate, 1);
+  s.field(config.alphaUpdate, 1);
+  s.field(config.colorUpdate, 1);
+}
+} // namespace
+
+PipelineKey pack_pipeline_config(const PipelineConfig& config) noexcept {
+  PipelineKey key{};
+  KeyWriter writer{key};
+  visit_pipeline_key(writer, config);
+#ifndef NDEBUG
+  PipelineConfig unpacked{};
+  unpack_pipeline_config(key, unpacked);
+  CHECK(memcmp(&unpacked, &config, sizeof(PipelineConfig)) == 0, "Pipeline key doesn't round-trip");
+#endif
+  return key;
+}
+
+void unpack_pipeline_config(const PipelineKey& key, PipelineConfig& config) noexcept {
+  config = {};
+  KeyReader reader{key};
+  visit_pipeline_key(reader, config);
+}
+
+static FogUniform build_fog_uniform() noexcept {
+  const auto& state = g_gxState.fog;
+  FogUniform fog{.color = state.color};
+  if (state.nearZ != state.farZ && state.startZ != state.endZ) {
+    const float depthRange = state.farZ - state.nearZ;
+    const float fogRange = state.endZ - state.startZ;
+    fog.a = (state.farZ * state.nearZ) / (depthRange * fogRange);
+    fog.b = state.farZ / depthRange;
+    fog.c = state.startZ / fogRange;
+  }
+  return fog;
+}
+
+UniformRanges build_uniform(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+  // Assembled before pushing, so that blocks identical to ones already pushed this frame are reused
+  static std::array<ByteBuffer, MaxUniformBlocks> sScratch;
+  const auto scratch = [](ByteBuffer& storage, u32 size) {
+    if (storage.size() < size) {
+      storage = ByteBuffer{size};
+    }
+    return ByteBuffer{storage.data(), size};
+  };
+  auto buf = scratch(sScratch[0], info.uniformSize);
+  auto frameBuf = scratch(sScratch[1], info.frameUniformSize);
+  auto materialBuf = scratch(sScratch[2], info.materialUniformSize);
+  buf.append(&g_gxState.pnMtx[g_gxState.currentPnMtx], 128);
+  frameBuf.append(&g_gxState.proj, 64);
   for (int i = 0; i < info.loadsTevReg.size(); ++i) {
     if (!info.loadsTevReg.test(i)) {
       continue;
     }
-    buf.append(&g_gxState.colorRegs[i], 16);
+    materialBuf.append(&g_gxState.colorRegs[i], 16);
   }
-  bool lightingEnabled = false;
-  for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
-    if (!info.sampledColorChannels.test(i)) {
-      continue;
-    }
-    const auto& ccc = g_gxState.colorChannelConfig[i * 2];
-    const auto& ccca = g_gxState.colorChannelConfig[i * 2 + 1];
-    if (ccc.lightingEnabled || ccca.lightingEnabled) {
-      lightingEnabled = true;
-      break;
+  if (config.lightCount > 0) {
+    // Lit channels' lights, packed to the front with the masks remapped to match
+    static_assert(sizeof(Light) == 80);
+    std::array<Light, GX::MaxLights> lights{};
+    std::array<u32, MaxColorChannels> lightState{};
+    const auto litLights = lit_lights(config);
+    u32 lightCount = 0;
+    for (u32 i = 0; i < GX::MaxLights; ++i) {
+      if (!litLights.test(i)) {
+        continue;
+      }
+      for (u32 j = 0; j < lightState.size(); ++j) {
+        if (config.colorChannels[j].lightingEnabled && g_gxState.colorChannelState[j].lightMask.test(i)) {
+          lightState[j] |= 1u << lightCount;
+        }
+      }
+      lights[lightCount++] = g_gxState.lights[i];
     }
-  }
-  if (lightingEnabled) {
-    // Lights
-    static_assert(sizeof(g_gxState.lights) == 80 * GX::MaxLights);
-    buf.append(&g_gxState.lights, 80 * GX::MaxLights);
+    CHECK(lightCount <= config.lightCount, "{} lights for a pipeline with {}", lightCount, config.lightCount);
+    frameBuf.append(lights.data(), sizeof(Light) * config.lightCount);
     // Light state for all channels
-    for (int i = 0; i < 4; ++i) {
-      u32 lightState = g_gxState.colorChannelState[i].lightMask.to_ulong();
-      buf.append(&lightState, 4);
-    }
+    frameBuf.append(&lightState, 16);
   }
   for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
     if (!info.sampledColorChannels.test(i)) {
@@ -366,25 +582,25 @@ Range build_uniform(const ShaderInfo& info) noexcept {
     const auto& ccc = g_gxState.colorChannelConfig[i * 2];
     const auto& ccs = g_gxState.colorChannelState[i * 2];
     if (ccc.lightingEnabled && ccc.ambSrc == GX_SRC_REG) {
-      buf.append(&ccs.ambColor, 16);
+      materialBuf.append(&ccs.ambColor, 16);
     }
     if (ccc.matSrc == GX_SRC_REG) {
-      buf.append(&ccs.matColor, 16);
+      materialBuf.append(&ccs.matColor, 16);
     }
     const auto& ccca = g_gxState.colorChannelConfig[i * 2 + 1];
     const auto& ccsa = g_gxState.colorChannelState[i * 2 + 1];
     if (ccca.lightingEnabled && ccca.ambSrc == GX_SRC_REG) {
-      buf.append(&ccsa.ambColor, 16);
+      materialBuf.append(&ccsa.ambColor, 16);
     }
     if (ccca.matSrc == GX_SRC_REG) {
-      buf.append(&ccsa.matColor, 16);
+      materialBuf.append(&ccsa.matColor, 16);
     }
   }
   for (int i = 0; i < info.sampledKColors.size(); ++i) {
     if (!info.sampledKColors.test(i)) {
       continue;
     }
-    buf.append(&g_gxState.kcolors[i], 16);
+    materialBuf.append(&g_gxState.kcolors[i], 16);
   }
   for (int i = 0; i < info.usesTexMtx.size(); ++i) {
     if (!info.usesTexMtx.test(i)) {
@@ -424,23 +640,159 @@ Range build_uniform(const ShaderInfo& info) noexcept {
     buf.append(&g_gxState.ptTexMtxs[i], 64);
   }
   if (info.usesFog) {
-    const auto& state = g_gxState.fog;
-    struct Fog {
-      Vec4<float> color = state.color;
-      float a = 0.f;
-      float b = 0.5f;
-      float c = 0.f;
-      float pad = FLT_MAX;
-    } fog{};
-    static_assert(sizeof(Fog) == 32);
-    if (state.nearZ != state.farZ && state.startZ != state.endZ) {
-      const float depthRange = state.farZ - state.nearZ;
-      const float fogRange = state.endZ - state.startZ;
-      fog.a = (state.farZ * state.nearZ) / (depthRange * fogRange);
-      fog.b = state.farZ / depthRange;
-      fog.c = state.startZ / fogRange;
-    }
-    buf.append(&fog, 32);
+    const auto fog = build_fog_uniform();
+    frameBuf.append(&fog, 32);
+  }
+  for (int i = 0; i < info.sampledTextures.size(); ++i) {
+    if (!info.sampledTextures.test(i)) {
+      continue;
+    }
+    const auto& tex = get_texture(static_cast<GXTexMapID>(i));
+    CHECK(tex, "unbound texture {}", i);
+    materialBuf.append(&tex.texObj.lodBias, 4);
+  }
+  const auto block = [](ByteBuffer& buf, u32 size) {
+    if (buf.size() < size) {
+      memset(buf.data() + buf.size(), 0, size - buf.size());
+    }
+    return ArrayRef<u8>{buf.data(), size};
+  };
+  return push_draw_uniforms(block(buf, info.uniformSize), block(frameBuf, info.frameUniformSize),
+                            block(materialBuf, info.materialUniformSize), info.perDrawStorage);
+}
+
+bool ubershader_supported(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+  if (config.ubershader) {
+    return false;
+  }
+  for (u32 i = 0; i < config.tevStageCount; ++i) {
+    const auto& stage = config.tevStages[i];
+    if (stage.colorOp.op > GX_TEV_SUB || stage.alphaOp.op > GX_TEV_SUB) {
+      return false;
+    }
+  }
+  for (int i = 0; i < info.sampledTextures.size(); ++i) {
+    if (info.sampledTextures.test(i) && is_palette_format(config.textureConfig[i].loadFmt)) {
+      return false;
+    }
+  }
+  for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
+    if (!info.sampledColorChannels.test(i)) {
+      continue;
+    }
+    const auto& cc = config.colorChannels[i * 2];
+    const auto& cca = config.colorChannels[i * 2 + 1];
+    if (cc.lightingEnabled && cc.attnFn == GX_AF_SPEC) {
+      return false;
+    }
+    // The uniform only encodes the color channel, which also supplies alpha
+    if (cca.lightingEnabled != cc.lightingEnabled || cca.matSrc != cc.matSrc ||
+        (cca.lightingEnabled &&
+         (cca.ambSrc != cc.ambSrc || cca.diffFn != cc.diffFn || cca.attnFn != cc.attnFn))) {
+      return false;
+    }
+  }
+  for (int i = 0; i < info.sampledTexCoords.size(); ++i) {
+    const auto src = config.tcgs[i].src;
+    if (info.sampledTexCoords.test(i) && src != GX_TG_POS && src != GX_TG_NRM &&
+        (src < GX_TG_TEX0 || src > GX_TG_TEX7)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ShaderConfig ubershader_config(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+  // Only the vertex format & texture bindings remain part of the shader key
+  ShaderConfig out{
+      .vtxAttrs = config.vtxAttrs,
+      .attrMapping = config.attrMapping,
+      .indexedAttributeCount = config.indexedAttributeCount,
+      .ubershader = true,
+      .sampledTextures = static_cast<u8>(info.sampledTextures.to_ulong()),
+  };
+  for (int i = 0; i < info.sampledTextures.size(); ++i) {
+    if (info.sampledTextures.test(i)) {
+      out.textureConfig[i] = config.textureConfig[i];
+    }
+  }
+  return out;
+}
+
+static inline u32 uber_tev_op(const TevOp& op) noexcept {
+  return op.op | op.bias << 1 | op.scale << 3 | op.outReg << 5 | u32(op.clamp) << 7;
+}
+
+static inline std::array<Vec4<float>, 3> uber_mtx_rows(const Mat4x4<float>& mtx) noexcept {
+  return {{
+      {mtx.m0.x(), mtx.m1.x(), mtx.m2.x(), mtx.m3.x()},
+      {mtx.m0.y(), mtx.m1.y(), mtx.m2.y(), mtx.m3.y()},
+      {mtx.m0.z(), mtx.m1.z(), mtx.m2.z(), mtx.m3.z()},
+  }};
+}
+
+static inline std::array<Vec4<float>, 3> uber_mtx_rows(const Mat4x2<float>& mtx) noexcept {
+  return {{
+      {mtx.m0.x, mtx.m0.y, mtx.m1.x, mtx.m1.y},
+      {mtx.m2.x, mtx.m2.y, mtx.m3.x, mtx.m3.y},
+      {0.f, 0.f, 0.f, 0.f},
+  }};
+}
+
+constexpr std::array<Vec4<float>, 3> UberIdentityRows{{
+    {1.f, 0.f, 0.f, 0.f},
+    {0.f, 1.f, 0.f, 0.f},
+    {0.f, 0.f, 1.f, 0.f},
+}};
+
+UniformRanges build_ubershader_uniform(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+  UberUniform uniform{
+      .pnMtx = g_gxState.pnMtx[g_gxState.currentPnMtx],
+      .proj = g_gxState.proj,
+      .tevRegs = g_gxState.colorRegs,
+      .kcolors = g_gxState.kcolors,
+      .lights = g_gxState.lights,
+      .fog = build_fog_uniform(),
+  };
+  for (int i = 0; i < MaxColorChannels; ++i) {
+    const auto& ccs = g_gxState.colorChannelState[i];
+    uniform.ambColors[i] = ccs.ambColor;
+    uniform.matColors[i] = ccs.matColor;
+    uniform.lightState[i] = ccs.lightMask.to_ulong();
+  }
+  for (int i = 0; i < MaxTexCoord; ++i) {
+    auto& texGen = uniform.texGens[i];
+    const auto& tcg = config.tcgs[i];
+    if (!info.sampledTexCoords.test(i)) {
+      texGen.src = GX_MAX_TEXGENSRC;
+      continue;
+    }
+    texGen.src = tcg.src;
+    texGen.normalize = tcg.normalize;
+    texGen.mtx = UberIdentityRows;
+    if (tcg.mtx != GX_IDENTITY) {
+      const u32 idx = (tcg.mtx - GX_TEXMTX0) / 3;
+      const auto& mtx = g_gxState.texMtxs[idx];
+      if (info.texMtxTypes[idx] == GX_TG_MTX3x4) {
+        CHECK(std::holds_alternative<Mat4x4<float>>(mtx), "expected 3x4 mtx in idx {}", idx);
+        texGen.mtx = uber_mtx_rows(std::get<Mat4x4<float>>(mtx));
+      } else if (std::holds_alternative<Mat4x2<float>>(mtx)) {
+        texGen.mtx = uber_mtx_rows(std::get<Mat4x2<float>>(mtx));
+      } else if (std::holds_alternative<Mat4x4<float>>(mtx)) {
+        // Same fallback as build_uniform
+        texGen.mtx = uber_mtx_rows(Mat4x2<float>{
+            {1.f, 0.f},
+            {0.f, 1.f},
+            {0.f, 0.f},
+            {0.f, 0.f},
+        });
+      } else
+        UNLIKELY FATAL("expected 2x4 mtx in idx {}", idx);
+    }
+    texGen.postMtx = UberIdentityRows;
+    if (tcg.postMtx != GX_PTIDENTITY) {
+      texGen.postMtx = uber_mtx_rows(g_gxState.ptTexMtxs[(tcg.postMtx - GX_PTTEXMTX0) / 3]);
+    }
   }
   for (int i = 0; i < info.sampledTextures.size(); ++i) {
     if (!info.sampledTextures.test(i)) {
@@ -448,27 +800,98 @@ Range build_uniform(const ShaderInfo& info) noexcept {
     }
     const auto& tex = get_texture(static_cast<GXTexMapID>(i));
     CHECK(tex, "unbound texture {}", i);
-    buf.append(&tex.texObj.lodBias, 4);
+    uniform.texLods[i] = tex.texObj.lodBias;
+  }
+  for (u32 i = 0; i < config.tevStageCount; ++i) {
+    const auto& stage = config.tevStages[i];
+    const auto& cp = stage.colorPass;
+    const auto& ap = stage.alphaPass;
+    u32 texCoordId = 0xFF;
+    u32 texMapId = 0xFF;
+    if (stage.texMapId != GX_TEXMAP_NULL && stage.texCoordId != GX_TEXCOORD_NULL &&
+        info.sampledTextures.test(stage.texMapId)) {
+      texCoordId = stage.texCoordId;
+      texMapId = stage.texMapId;
+    }
+    u32 channelId = 0xFF;
+    if (stage.channelId == GX_COLOR0A0 || stage.channelId == GX_COLOR1A1) {
+      channelId = stage.channelId - GX_COLOR0A0;
+    }
+    uniform.stages[i] = {
+        cp.a | cp.b << 4 | cp.c << 8 | cp.d << 12 | ap.a << 16 | ap.b << 19 | ap.c << 22 | ap.d << 25,
+        uber_tev_op(stage.colorOp) | uber_tev_op(stage.alphaOp) << 8 | stage.kcSel << 16 | stage.kaSel << 24,
+        texCoordId | texMapId << 8 | channelId << 16 | stage.tevSwapRas << 24 | stage.tevSwapTex << 28,
+        0,
+    };
+  }
+  for (int i = 0; i < MaxTevSwap; ++i) {
+    const auto& swap = config.tevSwapTable[i];
+    uniform.swapTable[i] = {swap.red, swap.green, swap.blue, swap.alpha};
+  }
+  u32 vtxColorIdx = 0;
+  for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
+    if (!info.sampledColorChannels.test(i)) {
+      continue;
+    }
+    const auto& cc = config.colorChannels[i * 2];
+    const auto& cca = config.colorChannels[i * 2 + 1];
+    uniform.channels[i] = {cc.lightingEnabled, cc.ambSrc, cc.matSrc,
+                           cc.diffFn | cc.attnFn << 8 | vtxColorIdx << 16};
+    // Matches vertex color assignment in build_shader
+    if ((cc.lightingEnabled && cc.ambSrc == GX_SRC_VTX) || cc.matSrc == GX_SRC_VTX || cca.matSrc == GX_SRC_VTX) {
+      ++vtxColorIdx;
+    }
   }
-  g_gxState.stateDirty = false;
-  return range;
+  const auto& ac = config.alphaCompare;
+  uniform.misc = {
+      config.tevStageCount,
+      config.fogType,
+      ac.comp0 | ac.comp1 << 3 | ac.op << 6 | (ac.ref0 & 0xFF) << 8 | (ac.ref1 & 0xFF) << 16 | u32(bool(ac)) << 31,
+      0,
+  };
+
+  return push_draw_uniforms({reinterpret_cast<const u8*>(&uniform), sizeof(UberUniform)}, {}, {}, false);
 }
 
-static absl::flat_hash_map<u32, wgpu::BindGroupLayout> sUniformBindGroupLayouts;
-static absl::flat_hash_map<u32, std::pair<wgpu::BindGroupLayout, wgpu::BindGroupLayout>> sTextureBindGroupLayouts;
+// Layouts only depend on the shape of the bindings, so they're keyed by:
+// uniform: material, frame & draw uniform sizes (16 bits each, draw is 0 for per-draw storage) + number of storage
+//          bindings (high 16 bits)
+// texture: number of sampled textures (low 4 bits) + copy/load palette flags for each (2 bits each)
+using UniformLayoutKey = u64;
+using TextureLayoutKey = u32;
+static std::mutex sLayoutMutex;
+static absl::flat_hash_map<UniformLayoutKey, wgpu::BindGroupLayout> sUniformBindGroupLayouts;
+static absl::flat_hash_map<TextureLayoutKey, std::pair<wgpu::BindGroupLayout, wgpu::BindGroupLayout>>
+    sTextureBindGroupLayouts;
+static absl::flat_hash_map<std::pair<UniformLayoutKey, TextureLayoutKey>, wgpu::PipelineLayout> sPipelineLayouts;
 
-GXBindGroups build_bind_groups(const ShaderInfo& info, const ShaderConfig& config,
-                               const BindGroupRanges& ranges) noexcept {
+std::atomic_uint32_t g_createdLayouts;
+
+GXBindGroups build_bind_groups(const ShaderInfo& info, const ShaderConfig& config, const BindGroupRanges& ranges,
+                               const UniformRanges& uniformRanges) noexcept {
   const auto layouts = build_bind_group_layouts(info, config);
 
-  std::array<wgpu::BindGroupEntry, GX_VA_MAX_ATTR + 1> uniformEntries{
+  std::array<wgpu::BindGroupEntry, MaxUniformBlocks + GX_VA_MAX_ATTR> uniformEntries{
       wgpu::BindGroupEntry{
           .binding = 0,
-          .buffer = g_uniformBuffer,
-          .size = info.uniformSize,
+          .buffer = uniform_buffer(uniformRanges.draw.chunk),
+          // Per-draw storage binds the whole buffer, shared by every draw
+          .size = info.perDrawStorage ? WGPU_WHOLE_SIZE : info.uniformSize,
       },
   };
   u32 uniformBindIdx = 1;
+  for (const auto& [size, range] : {std::pair{info.frameUniformSize, uniformRanges.frame},
+                                    std::pair{info.materialUniformSize, uniformRanges.material}}) {
+    if (size == 0) {
+      continue;
+    }
+    uniformEntries[uniformBindIdx] = wgpu::BindGroupEntry{
+        .binding = uniformBindIdx,
+        .buffer = uniform_buffer(range.chunk),
+        .size = size,
+    };
+    ++uniformBindIdx;
+  }
   for (u32 i = 0; i < GX_VA_MAX_ATTR; ++i) {
     const Range& range = ranges.vaRanges[i];
     if (range.size <= 0) {
@@ -476,7 +899,7 @@ GXBindGroups build_bind_groups(const ShaderInfo& info, const ShaderConfig& confi
     }
     uniformEntries[uniformBindIdx] = wgpu::BindGroupEntry{
         .binding = uniformBindIdx,
-        .buffer = g_storageBuffer,
+        .buffer = storage_buffer(range.chunk),
         .size = range.size,
     };
     ++uniformBindIdx;
@@ -537,56 +960,91 @@ GXBindGroups build_bind_groups(const ShaderInfo& info, const ShaderConfig& confi
   };
 }
 
-GXBindGroupLayouts build_bind_group_layouts(const ShaderInfo& info, const ShaderConfig& config) noexcept {
-  GXBindGroupLayouts out;
-  u32 uniformSizeKey = info.uniformSize + (config.indexedAttributeCount > 0 ? 1 : 0);
-  const auto uniformIt = sUniformBindGroupLayouts.find(uniformSizeKey);
-  if (uniformIt != sUniformBindGroupLayouts.end()) {
-    out.uniformLayout = uniformIt->second;
-  } else {
-    std::array<wgpu::BindGroupLayoutEntry, GX_VA_MAX_ATTR + 1> uniformLayoutEntries{
-        wgpu::BindGroupLayoutEntry{
-            .binding = 0,
-            .visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment,
-            .buffer =
-                wgpu::BufferBindingLayout{
-                    .type = wgpu::BufferBindingType::Uniform,
-                    .hasDynamicOffset = true,
-                    .minBindingSize = info.uniformSize,
-                },
-        },
-    };
-    u32 bindIdx = 1;
-    for (int i = 0; i < GX_VA_MAX_ATTR; ++i) {
-      if (config.attrMapping[i] == static_cast<GXAttr>(i)) {
-        uniformLayoutEntries[bindIdx] = wgpu::BindGroupLayoutEntry{
-            .binding = bindIdx,
-            .visibility = wgpu::ShaderStage::Vertex,
-            .buffer =
-                wgpu::BufferBindingLayout{
-                    .type = wgpu::BufferBindingType::ReadOnlyStorage,
-                    .hasDynamicOffset = true,
-                },
-        };
-        ++bindIdx;
-      }
+static UniformLayoutKey uniform_layout_key(const ShaderInfo& info, const ShaderConfig& config) noexcept {
+  u64 storageCount = 0;
+  for (int i = 0; i < GX_VA_MAX_ATTR; ++i) {
+    if (config.attrMapping[i] == static_cast<GXAttr>(i)) {
+      ++storageCount;
     }
-    const auto uniformLayoutDescriptor = wgpu::BindGroupLayoutDescriptor{
-        .label = "GX Uniform Bind Group Layout",
-        .entryCount = bindIdx,
-        .entries = uniformLayoutEntries.data(),
+  }
+  static_assert(sizeof(UberUniform) <= UINT16_MAX, "uniform layout key overflow");
+  const u64 drawSize = info.perDrawStorage ? 0 : info.uniformSize;
+  return storageCount << 48 | drawSize << 32 | u64{info.frameUniformSize} << 16 | info.materialUniformSize;
+}
+
+static TextureLayoutKey texture_layout_key(const ShaderInfo& info, const ShaderConfig& config) noexcept {
+  u32 count = 0;
+  u32 flags = 0;
+  for (u32 i = 0; i < info.sampledTextures.size(); ++i) {
+    if (!info.sampledTextures.test(i)) {
+      continue;
+    }
+    const auto& texConfig = config.textureConfig[i];
+    const u32 copyAsPalette = is_palette_format(texConfig.copyFmt) ? 1 : 0;
+    const u32 loadAsPalette = is_palette_format(texConfig.loadFmt) ? 1 : 0;
+    flags |= (copyAsPalette | loadAsPalette << 1) << (count * 2);
+    ++count;
+  }
+  static_assert(MaxTextures <= 8, "texture layout key overflow");
+  return flags << 4 | count;
+}
+
+static wgpu::BindGroupLayout create_uniform_layout(const ShaderInfo& info, const ShaderConfig& config) noexcept {
+  std::array<wgpu::BindGroupLayoutEntry, MaxUniformBlocks + GX_VA_MAX_ATTR> uniformLayoutEntries{
+      wgpu::BindGroupLayoutEntry{
+          .binding = 0,
+          .visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment,
+          .buffer =
+              info.perDrawStorage ? wgpu::BufferBindingLayout{.type = wgpu::BufferBindingType::ReadOnlyStorage}
+                                      : wgpu::BufferBindingLayout{
+                                            .type = wgpu::BufferBindingType::Uniform,
+                                            .hasDynamicOffset = true,
+                                            .minBindingSize = info.uniformSize,
+                                        },
+      },
+  };
+  u32 bindIdx = 1;
+  for (const u32 size : {info.frameUniformSize, info.materialUniformSize}) {
+    if (size == 0) {
+      continue;
+    }
+    uniformLayoutEntries[bindIdx] = wgpu::BindGroupLayoutEntry{
+        .binding = bindIdx,
+        .visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment,
+        .buffer =
+            wgpu::BufferBindingLayout{
+                .type = wgpu::BufferBindingType::Uniform,
+                .hasDynamicOffset = true,
+                .minBindingSize = size,
+            },
     };
-    out.uniformLayout = g_device.CreateBindGroupLayout(&uniformLayoutDescriptor);
-    //    sUniformBindGroupLayouts.try_emplace(uniformSizeKey, out.uniformLayout);
+    ++bindIdx;
   }
+  for (int i = 0; i < GX_VA_MAX_ATTR; ++i) {
+    if (config.attrMapping[i] == static_cast<GXAttr>(i)) {
+      uniformLayoutEntries[bindIdx] = wgpu::BindGroupLayoutEntry{
+          .binding = bindIdx,
+          .visibility = wgpu::ShaderStage::Vertex,
+          .buffer =
+              wgpu::BufferBindingLayout{
+                  .type = wgpu::BufferBindingType::ReadOnlyStorage,
+                  .hasDynamicOffset = true,
+              },
+      };
+      ++bindIdx;
+    }
+  }
+  const auto uniformLayoutDescriptor = wgpu::BindGroupLayoutDescriptor{
+      .label = "GX Uniform Bind Group Layout",
+      .entryCount = bindIdx,
+      .entries = uniformLayoutEntries.data(),
+  };
+  ++g_createdLayouts;
+  return g_device.CreateBindGroupLayout(&uniformLayoutDescriptor);
+}
 
-  //  u32 textureCount = info.sampledTextures.count();
-  //  const auto textureIt = sTextureBindGroupLayouts.find(textureCount);
-  //  if (textureIt != sTextureBindGroupLayouts.end()) {
-  //    const auto& [sl, tl] = textureIt->second;
-  //    out.samplerLayout = sl;
-  //    out.textureLayout = tl;
-  //  } else {
+static std::pair<wgpu::BindGroupLayout, wgpu::BindGroupLayout>
+create_texture_layouts(const ShaderInfo& info, const ShaderConfig& config) noexcept {
   u32 numSamplers = 0;
   u32 numTextures = 0;
   std::array<wgpu::BindGroupLayoutEntry, MaxTextures> samplerEntries;
@@ -639,13 +1097,14 @@ GXBindGroupLayouts build_bind_group_layouts(const ShaderInfo& info, const Shader
       ++numTextures;
     }
   }
+  std::pair<wgpu::BindGroupLayout, wgpu::BindGroupLayout> out;
   {
     const wgpu::BindGroupLayoutDescriptor descriptor{
         .label = "GX Sampler Bind Group Layout",
         .entryCount = numSamplers,
         .entries = samplerEntries.data(),
     };
-    out.samplerLayout = g_device.CreateBindGroupLayout(&descriptor);
+    out.first = g_device.CreateBindGroupLayout(&descriptor);
   }
   {
     const wgpu::BindGroupLayoutDescriptor descriptor{
@@ -653,19 +1112,62 @@ GXBindGroupLayouts build_bind_group_layouts(const ShaderInfo& info, const Shader
         .entryCount = numTextures,
         .entries = textureEntries.data(),
     };
-    out.textureLayout = g_device.CreateBindGroupLayout(&descriptor);
+    out.second = g_device.CreateBindGroupLayout(&descriptor);
+  }
+  g_createdLayouts += 2;
+  return out;
+}
+
+GXBindGroupLayouts build_bind_group_layouts(const ShaderInfo& info, const ShaderConfig& config) noexcept {
+  const auto uniformKey = uniform_layout_key(info, config);
+  const auto textureKey = texture_layout_key(info, config);
+
+  // Called from both the pipeline thread and the main thread
+  std::scoped_lock guard{sLayoutMutex};
+  GXBindGroupLayouts out;
+  const auto uniformIt = sUniformBindGroupLayouts.find(uniformKey);
+  if (uniformIt != sUniformBindGroupLayouts.end()) {
+    out.uniformLayout = uniformIt->second;
+  } else {
+    out.uniformLayout = create_uniform_layout(info, config);
+    sUniformBindGroupLayouts.try_emplace(uniformKey, out.uniformLayout);
+  }
+  const auto textureIt = sTextureBindGroupLayouts.find(textureKey);
+  if (textureIt != sTextureBindGroupLayouts.end()) {
+    std::tie(out.samplerLayout, out.textureLayout) = textureIt->second;
+  } else {
+    std::tie(out.samplerLayout, out.textureLayout) =
+        sTextureBindGroupLayouts.try_emplace(textureKey, create_texture_layouts(info, config)).first->second;
+  }
+  const auto pipelineIt = sPipelineLayouts.find(std::pair{uniformKey, textureKey});
+  if (pipelineIt != sPipelineLayouts.end()) {
+    out.pipelineLayout = pipelineIt->second;
+  } else {
+    const std::array bindGroupLayouts{
+        out.uniformLayout,
+        out.samplerLayout,
+        out.textureLayout,
+    };
+    const wgpu::PipelineLayoutDescriptor pipelineLayoutDescriptor{
+        .label = "GX Pipeline Layout",
+        .bindGroupLayoutCount = static_cast<uint32_t>(info.sampledTextures.any() ? bindGroupLayouts.size() : 1),
+        .bindGroupLayouts = bindGroupLayouts.data(),
+    };
+    out.pipelineLayout = g_device.CreatePipelineLayout(&pipelineLayoutDescriptor);
+    sPipelineLayouts.try_emplace(std::pair{uniformKey, textureKey}, out.pipelineLayout);
+    ++g_createdLayouts;
   }
-  //    sTextureBindGroupLayouts.try_emplace(textureCount, out.samplerLayout, out.textureLayout);
-  //  }
   return out;
 }
 
 // TODO this is awkward
 extern absl::flat_hash_map<ShaderRef, std::pair<wgpu::ShaderModule, gx::ShaderInfo>> g_gxCachedShaders;
+extern absl::flat_hash_map<ShaderRef, gx::ShaderInfo> g_gxShaderInfos;
 void shutdown() noexcept {
   // TODO we should probably store this all in g_state.gx instead
   sUniformBindGroupLayouts.clear();
   sTextureBindGroupLayouts.clear();
+  sPipelineLayouts.clear();
   for (auto& item : g_gxState.textures) {
     item.texObj.ref.reset();
   }
@@ -673,6 +1175,14 @@ void shutdown() noexcept {
     item.ref.reset();
   }
   g_gxCachedShaders.clear();
+  g_gxShaderInfos.clear();
+  g_lastDraw.reset();
+#ifndef NDEBUG
+  Log.report(LOG_INFO, FMT_STRING("Canonicalized {} shader configs to {}"), sRawShaderConfigs.size(),
+             sCanonicalShaderConfigs.size());
+  sRawShaderConfigs.clear();
+  sCanonicalShaderConfigs.clear();
+#endif
   g_gxState.copyTextures.clear();
 }
 } // namespace gx
@@ -13,7 +13,10 @@
 #include <cstring>
 #include <bitset>
 #include <memory>
+#include <optional>
 #include <array>
+#include <atomic>
+#include <cfloat>
 
 #define M_PIF 3.14159265358979323846f
 
@@ -61,6 +64,7 @@ constexpr u32 MaxIndStages = GX_MAX_INDTEXSTAGE;
 constexpr u32 MaxIndTexMtxs = 3;
 constexpr u32 MaxVtxFmt = GX_MAX_VTXFMT;
 constexpr u32 MaxPnMtx = (GX_PNMTX9 / 3) + 1;
+constexpr u32 MaxUniformBlocks = 3; // See UniformRanges
 
 template <typename Arg, Arg Default>
 struct TevPass {
@@ -234,13 +238,27 @@ struct AttrArray {
   const void* data;
   u32 size;
   u8 stride;
-  Range cachedRange;
+  Range cachedRange; // Uploaded contents, until GXSetArray changes the array or GXInvalidateVtxCache
 };
 inline bool operator==(const AttrArray& lhs, const AttrArray& rhs) {
   return lhs.data == rhs.data && lhs.size == rhs.size && lhs.stride == rhs.stride;
 }
 inline bool operator!=(const AttrArray& lhs, const AttrArray& rhs) { return !(lhs == rhs); }
 
+// Groups of GXState with their own dirty bit, so a draw only redoes the work affected by a change
+enum DirtyFlag : u32 {
+  DirtyPipeline = 1 << 0,     // Anything that feeds PipelineConfig
+  DirtyTevConstants = 1 << 1, // TEV & konst color registers, fog parameters
+  DirtyMatrices = 1 << 2,     // Position, normal, projection & texture matrices
+  DirtyLights = 1 << 3,       // Lights, channel colors & light masks
+  DirtyTextures = 1 << 4,     // Bound textures & samplers
+  DirtyVtxArrays = 1 << 5,
+  DirtyAll = (1 << 6) - 1,
+};
+using DirtyFlags = u32;
+// Only the uniform buffer depends on these
+constexpr DirtyFlags DirtyUniforms = DirtyTevConstants | DirtyMatrices | DirtyLights;
+
 struct GXState {
   std::array<PnMtx, MaxPnMtx> pnMtx;
   u32 currentPnMtx;
@@ -290,7 +308,7 @@ struct GXState {
   u8 numIndStages = 0;
   u8 numTevStages = 0;
   u8 numTexGens = 0;
-  bool stateDirty = true;
+  DirtyFlags dirtyState = DirtyAll;
 };
 extern GXState g_gxState;
 
@@ -358,12 +376,17 @@ struct ShaderConfig {
   AlphaCompare alphaCompare;
   u32 indexedAttributeCount = 0;
   std::array<TextureConfig, MaxTextures> textureConfig;
+  // Ubershader variant: TEV, lighting, texgen & fog state is read from the uniform instead
+  bool ubershader = false;
+  u8 sampledTextures = 0; // ubershader only
+  u8 lightCount = 0;      // Size of the lights array: lit channels' lights rounded up to 1, 2, 4 or 8
+  u8 _p2 = 0;
 
   bool operator==(const ShaderConfig& rhs) const { return memcmp(this, &rhs, sizeof(*this)) == 0; }
 };
 static_assert(std::has_unique_object_representations_v<ShaderConfig>);
 
-constexpr u32 GXPipelineConfigVersion = 4;
+constexpr u32 GXPipelineConfigVersion = 8;
 struct PipelineConfig {
   u32 version = GXPipelineConfigVersion;
   ShaderConfig shaderConfig;
@@ -377,17 +400,56 @@ struct PipelineConfig {
   bool depthCompare, depthUpdate, alphaUpdate, colorUpdate;
 };
 static_assert(std::has_unique_object_representations_v<PipelineConfig>);
+// Bit-packed PipelineConfig (296 bytes vs ~2.7 KiB), used for pipeline hashing, queueing & pipeline_cache.bin.
+// It's expanded back into a PipelineConfig only when the pipeline is built.
+constexpr size_t PipelineKeyWords = 36;
+struct PipelineKey {
+  u32 version = GXPipelineConfigVersion;
+  u32 _pad = 0;
+  std::array<u64, PipelineKeyWords> bits{};
+};
+static_assert(std::has_unique_object_representations_v<PipelineKey>);
+PipelineKey pack_pipeline_config(const PipelineConfig& config) noexcept;
+void unpack_pipeline_config(const PipelineKey& key, PipelineConfig& config) noexcept;
 
 struct GXBindGroupLayouts {
   wgpu::BindGroupLayout uniformLayout;
   wgpu::BindGroupLayout samplerLayout;
   wgpu::BindGroupLayout textureLayout;
+  wgpu::PipelineLayout pipelineLayout;
 };
 struct GXBindGroups {
   BindGroupRef uniformBindGroup;
   BindGroupRef samplerBindGroup;
   BindGroupRef textureBindGroup;
 };
+// A draw as replayed from a render pass' command stream
+struct DrawCommand {
+  PipelineRef pipeline;
+  const GXBindGroups& bindGroups;
+  Range vertRange;
+  Range indexRange;
+  UniformRanges uniformRanges;
+  u32 indexCount;
+  wgpu::IndexFormat indexFormat; // Uint32 once merged past 65536 vertices
+  bool perDrawStorage;           // Uniform is indexed by firstInstance rather than bound at its offset
+  u32 firstInstance;
+  u32 dstAlpha;
+  ArrayRef<u32> storageOffsets; // Bound vertex attribute arrays, model only
+};
+// Dynamic offsets of the draw's uniform bindings, in binding order
+static inline u32 uniform_offsets(const DrawCommand& draw, u32* offsets) noexcept {
+  u32 count = 0;
+  if (!draw.perDrawStorage) {
+    offsets[count++] = draw.uniformRanges.draw.offset;
+  }
+  for (const auto& range : {draw.uniformRanges.frame, draw.uniformRanges.material}) {
+    if (range.size > 0) {
+      offsets[count++] = range.offset;
+    }
+  }
+  return count;
+}
 // Output info from shader generation
 struct ShaderInfo {
   std::bitset<MaxTexCoord> sampledTexCoords;
@@ -399,21 +461,152 @@ struct ShaderInfo {
   std::bitset<MaxTexMtx> usesTexMtx;
   std::bitset<MaxPTTexMtx> usesPTTexMtx;
   std::array<GXTexGenType, MaxTexMtx> texMtxTypes{};
-  u32 uniformSize = 0;
+  u32 uniformSize = 0;         // Per-draw block
+  u32 frameUniformSize = 0;    // Per-frame block, specialized shaders only
+  u32 materialUniformSize = 0; // Per-material block, 0 if unused
   bool usesFog : 1 = false;
+  bool perDrawStorage : 1 = false; // See AuroraConfig::perDrawStorage, never set for ubershaders
+  ShaderRef shaderHash = 0; // of the ShaderConfig this was built from
 };
 struct BindGroupRanges {
   std::array<Range, GX_VA_MAX_ATTR> vaRanges{};
 };
+struct FogUniform {
+  Vec4<float> color;
+  float a = 0.f;
+  float b = 0.5f;
+  float c = 0.f;
+  float pad = FLT_MAX;
+};
+static_assert(sizeof(FogUniform) == 32);
+// Ubershader uniform, must match the layout in build_ubershader_source
+struct UberTexGen {
+  std::array<Vec4<float>, 3> mtx;
+  std::array<Vec4<float>, 3> postMtx;
+  u32 src; // GX_MAX_TEXGENSRC = unused
+  u32 normalize;
+  u32 _p1;
+  u32 _p2;
+};
+static_assert(sizeof(UberTexGen) == 112);
+struct UberUniform {
+  PnMtx pnMtx;
+  Mat4x4<float> proj;
+  std::array<Vec4<float>, MaxTevRegs> tevRegs;
+  std::array<Vec4<float>, MaxKColors> kcolors;
+  std::array<Vec4<float>, MaxColorChannels> ambColors;
+  std::array<Vec4<float>, MaxColorChannels> matColors;
+  std::array<Light, GX::MaxLights> lights;
+  std::array<u32, MaxColorChannels> lightState;
+  std::array<UberTexGen, MaxTexCoord> texGens;
+  FogUniform fog;
+  std::array<float, MaxTextures> texLods;
+  // x: color & alpha args, y: color & alpha ops + konst sel, z: texcoord, texmap, channel & swaps
+  std::array<std::array<u32, 4>, MaxTevStages> stages;
+  std::array<std::array<u32, 4>, MaxTevSwap> swapTable;
+  // lighting enabled, amb src, mat src, diff fn | attn fn << 8 | vtx color idx << 16
+  std::array<std::array<u32, 4>, MaxColorChannels / 2> channels;
+  // stage count, fog type, alpha compare
+  std::array<u32, 4> misc;
+};
+static_assert(sizeof(UberUniform) == 2432);
 void populate_pipeline_config(PipelineConfig& config, GXPrimitive primitive) noexcept;
 wgpu::RenderPipeline build_pipeline(const PipelineConfig& config, const ShaderInfo& info,
                                     ArrayRef<wgpu::VertexBufferLayout> vtxBuffers, wgpu::ShaderModule shader,
                                     const char* label) noexcept;
+// Resets state the generated shader can't observe, so configs that only differ in dead state share a pipeline
+void canonicalize_shader_config(ShaderConfig& config) noexcept;
 ShaderInfo build_shader_info(const ShaderConfig& config) noexcept;
 wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& info) noexcept;
 // Range build_vertex_buffer(const GXShaderInfo& info) noexcept;
-Range build_uniform(const ShaderInfo& info) noexcept;
+UniformRanges build_uniform(const ShaderConfig& config, const ShaderInfo& info) noexcept;
+bool ubershader_supported(const ShaderConfig& config, const ShaderInfo& info) noexcept;
+ShaderConfig ubershader_config(const ShaderConfig& config, const ShaderInfo& info) noexcept;
+UniformRanges build_ubershader_uniform(const ShaderConfig& config, const ShaderInfo& info) noexcept;
 GXBindGroupLayouts build_bind_group_layouts(const ShaderInfo& info, const ShaderConfig& config) noexcept;
-GXBindGroups build_bind_groups(const ShaderInfo& info, const ShaderConfig& config,
-                               const BindGroupRanges& ranges) noexcept;
+GXBindGroups build_bind_groups(const ShaderInfo& info, const ShaderConfig& config, const BindGroupRanges& ranges,
+                               const UniformRanges& uniformRanges) noexcept;
+
+// Resolves the pipeline & uniform for a draw. While the specialized pipeline is still compiling (or when
+// ubershaders are forced), the draw is redirected to the ubershader variant; config & info are updated to match.
+template <typename T>
+std::pair<PipelineRef, UniformRanges> build_pipeline_uniform(T& config, ShaderInfo& info) noexcept {
+  PipelineRef ref = 0;
+  if (!g_config.forceUbershader) {
+    ref = pipeline_ref(config);
+    if (pipeline_ready(ref)) {
+      return {ref, build_uniform(config.shaderConfig, info)};
+    }
+  }
+  if (!ubershader_supported(config.shaderConfig, info)) {
+    if (g_config.forceUbershader) {
+      ref = pipeline_ref(config);
+    }
+    return {ref, build_uniform(config.shaderConfig, info)};
+  }
+  const auto ranges = build_ubershader_uniform(config.shaderConfig, info);
+  config.shaderConfig = ubershader_config(config.shaderConfig, info);
+  info = build_shader_info(config.shaderConfig);
+  return {pipeline_ref(config), ranges};
+}
+
+// Pipeline state resolved by the last full draw. While only uniform groups are dirty, the next draw of
+// the same type reuses it and skips populate_pipeline_config & the pipeline lookup.
+struct ResolvedDraw {
+  ShaderType type;
+  PipelineRef pipeline;
+  ShaderConfig shaderConfig;
+  ShaderInfo info;
+  GXBindGroups bindGroups;
+  std::array<u32, MaxUniformBlocks> uniformChunks; // See uniform_chunks
+};
+extern std::optional<ResolvedDraw> g_lastDraw;
+// Bind group & pipeline layouts created this frame, for imgui debug. Stays 0 once every layout shape was seen.
+extern std::atomic_uint32_t g_createdLayouts;
+
+static inline const ResolvedDraw* reusable_draw(ShaderType type) noexcept {
+  if ((g_gxState.dirtyState & ~DirtyUniforms) != 0 || !g_lastDraw || g_lastDraw->type != type) {
+    return nullptr;
+  }
+  return &*g_lastDraw;
+}
+
+// Buffers the uniform bind group was built for; frame & material blocks may be resident, see push_draw_uniforms
+static inline std::array<u32, MaxUniformBlocks> uniform_chunks(const UniformRanges& ranges) noexcept {
+  return {ranges.draw.chunk, ranges.frame.chunk, ranges.material.chunk};
+}
+
+// Bind groups of the last draw for uniforms pushed to the same buffers, rebuilt if they landed in other ones
+static inline const GXBindGroups& reuse_bind_groups(const UniformRanges& uniformRanges) noexcept {
+  const auto chunks = uniform_chunks(uniformRanges);
+  if (g_lastDraw->uniformChunks != chunks) {
+    g_lastDraw->bindGroups = build_bind_groups(g_lastDraw->info, g_lastDraw->shaderConfig, {}, uniformRanges);
+    g_lastDraw->uniformChunks = chunks;
+  }
+  return g_lastDraw->bindGroups;
+}
+
+template <typename T>
+void set_last_draw(ShaderType type, PipelineRef pipeline, const T& config, const ShaderInfo& info,
+                   const GXBindGroups& bindGroups, const UniformRanges& uniformRanges) noexcept {
+  if (config.shaderConfig.ubershader) {
+    // Switch back to the specialized pipeline as soon as it's ready
+    g_lastDraw.reset();
+  } else {
+    g_lastDraw = ResolvedDraw{type, pipeline, config.shaderConfig, info, bindGroups, uniform_chunks(uniformRanges)};
+  }
+  g_gxState.dirtyState = 0;
+}
+
+// Nonzero when a draw with the current state may be reordered among other opaque draws: nothing blends with the
+// framebuffer, and visibility is decided by an ordered depth test. Only draws with equal values (same depth func
+// & write masks) are reordered among each other; then only fragments at exactly equal depth can resolve differently.
+static inline u8 opaque_draw_state() noexcept {
+  const auto func = g_gxState.depthFunc;
+  if (g_gxState.blendMode != GX_BM_NONE || !g_gxState.depthCompare || !g_gxState.depthUpdate ||
+      (func != GX_LESS && func != GX_LEQUAL && func != GX_GREATER && func != GX_GEQUAL)) {
+    return 0;
+  }
+  return 1 | func << 1 | g_gxState.colorUpdate << 4 | g_gxState.alphaUpdate << 5;
+}
 } // namespace aurora::gfx::gx
@@ -4,6 +4,7 @@
 #include "gx.hpp"
 
 #include <absl/container/flat_hash_map.h>
+#include <mutex>
 
 constexpr bool EnableNormalVisualization = false;
 constexpr bool EnableDebugPrints = false;
@@ -16,10 +17,15 @@ using namespace std::string_view_literals;
 
 static Module Log("aurora::gfx::gx");
 
+// Guards g_gxCachedShaders, build_shader is called from pipeline threads
+static std::mutex g_gxCachedShadersMutex;
 absl::flat_hash_map<ShaderRef, std::pair<wgpu::ShaderModule, gx::ShaderInfo>> g_gxCachedShaders;
 #ifndef NDEBUG
 static absl::flat_hash_map<ShaderRef, gx::ShaderConfig> g_gxCachedShaderConfigs;
 #endif
+// ShaderConfig hash -> ShaderInfo, build_shader_info runs for every dirty draw
+static std::mutex g_gxShaderInfosMutex;
+absl::flat_hash_map<ShaderRef, gx::ShaderInfo> g_gxShaderInfos;
 
 static inline std::string_view chan_comp(GXTevColorChan chan) noexcept {
   switch (chan) {
@@ -214,45 +220,45 @@ static std::string color_arg_reg(GXTevColorArg arg, size_t stageIdx, const Shade
     case GX_TEV_KCSEL_1_8:
       return "vec3<f32>(1.0/8.0)";
     case GX_TEV_KCSEL_K0:
-      return "ubuf.kcolor0.rgb";
+      return "mbuf.kcolor0.rgb";
     case GX_TEV_KCSEL_K1:
-      return "ubuf.kcolor1.rgb";
+      return "mbuf.kcolor1.rgb";
     case GX_TEV_KCSEL_K2:
-      return "ubuf.kcolor2.rgb";
+      return "mbuf.kcolor2.rgb";
     case GX_TEV_KCSEL_K3:
-      return "ubuf.kcolor3.rgb";
+      return "mbuf.kcolor3.rgb";
     case GX_TEV_KCSEL_K0_R:
-      return "vec3<f32>(ubuf.kcolor0.r)";
+      return "vec3<f32>(mbuf.kcolor0.r)";
     case GX_TEV_KCSEL_K1_R:
-      return "vec3<f32>(ubuf.kcolor1.r)";
+      return "vec3<f32>(mbuf.kcolor1.r)";
     case GX_TEV_KCSEL_K2_R:
-      return "vec3<f32>(ubuf.kcolor2.r)";
+      return "vec3<f32>(mbuf.kcolor2.r)";
     case GX_TEV_KCSEL_K3_R:
-      return "vec3<f32>(ubuf.kcolor3.r)";
+      return "vec3<f32>(mbuf.kcolor3.r)";
     case GX_TEV_KCSEL_K0_G:
-      return "vec3<f32>(ubuf.kcolor0.g)";
+      return "vec3<f32>(mbuf.kcolor0.g)";
     case GX_TEV_KCSEL_K1_G:
-      return "vec3<f32>(ubuf.kcolor1.g)";
+      return "vec3<f32>(mbuf.kcolor1.g)";
     case GX_TEV_KCSEL_K2_G:
-      return "vec3<f32>(ubuf.kcolor2.g)";
+      return "vec3<f32>(mbuf.kcolor2.g)";
     case GX_TEV_KCSEL_K3_G:
-      return "vec3<f32>(ubuf.kcolor3.g)";
+      return "vec3<f32>(mbuf.kcolor3.g)";
     case GX_TEV_KCSEL_K0_B:
-      return "vec3<f32>(ubuf.kcolor0.b)";
+      return "vec3<f32>(mbuf.kcolor0.b)";
     case GX_TEV_KCSEL_K1_B:
-      return "vec3<f32>(ubuf.kcolor1.b)";
+      return "vec3<f32>(mbuf.kcolor1.b)";
     case GX_TEV_KCSEL_K2_B:
-      return "vec3<f32>(ubuf.kcolor2.b)";
+      return "vec3<f32>(mbuf.kcolor2.b)";
     case GX_TEV_KCSEL_K3_B:
-      return "vec3<f32>(ubuf.kcolor3.b)";
+      return "vec3<f32>(mbuf.kcolor3.b)";
     case GX_TEV_KCSEL_K0_A:
-      return "vec3<f32>(ubuf.kcolor0.a)";
+      return "vec3<f32>(mbuf.kcolor0.a)";
     case GX_TEV_KCSEL_K1_A:
-      return "vec3<f32>(ubuf.kcolor1.a)";
+      return "vec3<f32>(mbuf.kcolor1.a)";
     case GX_TEV_KCSEL_K2_A:
-      return "vec3<f32>(ubuf.kcolor2.a)";
+      return "vec3<f32>(mbuf.kcolor2.a)";
     case GX_TEV_KCSEL_K3_A:
-      return "vec3<f32>(ubuf.kcolor3.a)";
+      return "vec3<f32>(mbuf.kcolor3.a)";
     }
   }
   case GX_CC_ZERO:
@@ -378,37 +384,37 @@ static std::string alpha_arg_reg(GXTevAlphaArg arg, size_t stageIdx, const Shade
     case GX_TEV_KASEL_1_8:
       return "(1.0/8.0)";
     case GX_TEV_KASEL_K0_R:
-      return "ubuf.kcolor0.r";
+      return "mbuf.kcolor0.r";
     case GX_TEV_KASEL_K1_R:
-      return "ubuf.kcolor1.r";
+      return "mbuf.kcolor1.r";
     case GX_TEV_KASEL_K2_R:
-      return "ubuf.kcolor2.r";
+      return "mbuf.kcolor2.r";
     case GX_TEV_KASEL_K3_R:
-      return "ubuf.kcolor3.r";
+      return "mbuf.kcolor3.r";
     case GX_TEV_KASEL_K0_G:
-      return "ubuf.kcolor0.g";
+      return "mbuf.kcolor0.g";
     case GX_TEV_KASEL_K1_G:
-      return "ubuf.kcolor1.g";
+      return "mbuf.kcolor1.g";
     case GX_TEV_KASEL_K2_G:
-      return "ubuf.kcolor2.g";
+      return "mbuf.kcolor2.g";
     case GX_TEV_KASEL_K3_G:
-      return "ubuf.kcolor3.g";
+      return "mbuf.kcolor3.g";
     case GX_TEV_KASEL_K0_B:
-      return "ubuf.kcolor0.b";
+      return "mbuf.kcolor0.b";
     case GX_TEV_KASEL_K1_B:
-      return "ubuf.kcolor1.b";
+      return "mbuf.kcolor1.b";
     case GX_TEV_KASEL_K2_B:
-      return "ubuf.kcolor2.b";
+      return "mbuf.kcolor2.b";
     case GX_TEV_KASEL_K3_B:
-      return "ubuf.kcolor3.b";
+      return "mbuf.kcolor3.b";
     case GX_TEV_KASEL_K0_A:
-      return "ubuf.kcolor0.a";
+      return "mbuf.kcolor0.a";
     case GX_TEV_KASEL_K1_A:
-      return "ubuf.kcolor1.a";
+      return "mbuf.kcolor1.a";
     case GX_TEV_KASEL_K2_A:
-      return "ubuf.kcolor2.a";
+      return "mbuf.kcolor2.a";
     case GX_TEV_KASEL_K3_A:
-      return "ubuf.kcolor3.a";
+      return "mbuf.kcolor3.a";
     }
   }
   case GX_CA_ZERO:
@@ -476,6 +482,29 @@ static std::string_view tev_scale(GXTevScale scale) {
   }
 }
 
+constexpr std::string_view MatrixFns = R"""(
+struct mtx4x4 { mx: vec4<f32>, my: vec4<f32>, mz: vec4<f32>, mw: vec4<f32> };
+struct mtx4x3 { mx: vec4<f32>, my: vec4<f32>, mz: vec4<f32>, mw: vec4<f32> };
+struct mtx4x2 { mx: vec4<f32>, my: vec4<f32>, };
+// TODO convert these to row major
+fn mul4x4(m: mtx4x4, v: vec4<f32>) -> vec4<f32> {
+  var mx = vec4<f32>(m.mx.x, m.my.x, m.mz.x, m.mw.x);
+  var my = vec4<f32>(m.mx.y, m.my.y, m.mz.y, m.mw.y);
+  var mz = vec4<f32>(m.mx.z, m.my.z, m.mz.z, m.mw.z);
+  var mw = vec4<f32>(m.mx.w, m.my.w, m.mz.w, m.mw.w);
+  return vec4<f32>(dot(mx, v), dot(my, v), dot(mz, v), dot(mw, v));
+}
+fn mul4x3(m: mtx4x3, v: vec4<f32>) -> vec3<f32> {
+  var mx = vec4<f32>(m.mx.x, m.my.x, m.mz.x, m.mw.x);
+  var my = vec4<f32>(m.mx.y, m.my.y, m.mz.y, m.mw.y);
+  var mz = vec4<f32>(m.mx.z, m.my.z, m.mz.z, m.mw.z);
+  return vec3<f32>(dot(mx, v), dot(my, v), dot(mz, v));
+}
+fn mul4x2(m: mtx4x2, v: vec4<f32>) -> vec2<f32> {
+  return vec2<f32>(dot(m.mx, v), dot(m.my, v));
+}
+)"""sv;
+
 static inline std::string vtx_attr(const ShaderConfig& config, GXAttr attr) {
   const auto type = config.vtxAttrs[attr];
   if (type == GX_NONE) {
@@ -550,16 +579,93 @@ constexpr std::array<std::string_view, MaxVtxAttr> VtxAttributeNames{
     "pos_mtx_array", "nrm_mtx_array", "tex_mtx_array", "light_array", "nbt",
 };
 
-ShaderInfo build_shader_info(const ShaderConfig& config) noexcept {
-  //  const auto hash = xxh3_hash(config);
-  //  const auto it = g_gxCachedShaders.find(hash);
-  //  if (it != g_gxCachedShaders.end()) {
-  //    return it->second.second;
-  //  }
+// Vertex inputs & storage bindings for indexed attributes, shared with the ubershader
+static void build_vtx_inputs(const ShaderConfig& config, std::string& vtxInAttrs, std::string& vtxXfrAttrsPre,
+                             std::string& uniformBindings, size_t uniBindingIdx, std::string_view projMtx) noexcept {
+  size_t locIdx = 0;
+  if (config.indexedAttributeCount > 0) {
+    // Display list attributes
+    int currAttrIdx = 0;
+    for (GXAttr attr{}; attr < MaxVtxAttr; attr = GXAttr(attr + 1)) {
+      // Indexed attributes
+      if (config.vtxAttrs[attr] != GX_INDEX8 && config.vtxAttrs[attr] != GX_INDEX16) {
+        continue;
+      }
+      const auto [div, rem] = std::div(currAttrIdx, 4);
+      std::string_view attrName;
+      bool addUniformBinding = true;
+      if (config.attrMapping[attr] != attr) {
+        attrName = VtxAttributeNames[config.attrMapping[attr]];
+        addUniformBinding = false;
+      } else {
+        attrName = VtxAttributeNames[attr];
+      }
+      vtxXfrAttrsPre +=
+          fmt::format(FMT_STRING("\n    var {} = v_arr_{}[in_dl{}[{}]];"), vtx_attr(config, attr), attrName, div, rem);
+      if (addUniformBinding) {
+        std::string_view arrType;
+        if (attr == GX_VA_POS || attr == GX_VA_NRM) {
+          arrType = "vec3<f32>";
+        } else if (attr >= GX_VA_TEX0 && attr <= GX_VA_TEX7) {
+          arrType = "vec2<f32>";
+        }
+        uniformBindings += fmt::format(FMT_STRING("\n@group(0) @binding({})"
+                                                  "\nvar<storage, read> v_arr_{}: array<{}>;"),
+                                       uniBindingIdx++, attrName, arrType);
+      }
+      ++currAttrIdx;
+    }
+    auto [num4xAttrArrays, rem] = std::div(currAttrIdx, 4);
+    u32 num2xAttrArrays = 0;
+    if (rem > 2) {
+      ++num4xAttrArrays;
+    } else if (rem > 0) {
+      num2xAttrArrays = 1;
+    }
+    for (u32 i = 0; i < num4xAttrArrays; ++i) {
+      if (locIdx > 0) {
+        vtxInAttrs += "\n    , ";
+      } else {
+        vtxInAttrs += "\n    ";
+      }
+      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_dl{}: vec4<i32>"), locIdx++, i);
+    }
+    for (u32 i = 0; i < num2xAttrArrays; ++i) {
+      if (locIdx > 0) {
+        vtxInAttrs += "\n    , ";
+      } else {
+        vtxInAttrs += "\n    ";
+      }
+      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_dl{}: vec2<i32>"), locIdx++, num4xAttrArrays + i);
+    }
+  }
+  for (GXAttr attr{}; attr < MaxVtxAttr; attr = GXAttr(attr + 1)) {
+    // Direct attributes
+    if (config.vtxAttrs[attr] != GX_DIRECT) {
+      continue;
+    }
+    if (locIdx > 0) {
+      vtxInAttrs += "\n    , ";
+    } else {
+      vtxInAttrs += "\n    ";
+    }
+    if (attr == GX_VA_POS) {
+      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_pos: vec3<f32>"), locIdx++);
+    } else if (attr == GX_VA_NRM) {
+      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_nrm: vec3<f32>"), locIdx++);
+    } else if (attr == GX_VA_CLR0 || attr == GX_VA_CLR1) {
+      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_clr{}: vec4<f32>"), locIdx++, attr - GX_VA_CLR0);
+    } else if (attr >= GX_VA_TEX0 && attr <= GX_VA_TEX7) {
+      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_tex{}_uv: vec2<f32>"), locIdx++, attr - GX_VA_TEX0);
+    }
+  }
+  vtxXfrAttrsPre += fmt::format(FMT_STRING("\n    var mv_pos = mul4x3(ubuf.pos_mtx, vec4<f32>({}, 1.0));"
+                                           "\n    var mv_nrm = normalize(mul4x3(ubuf.nrm_mtx, vec4<f32>({}, 0.0)));"
+                                           "\n    out.pos = mul4x4({}, vec4<f32>(mv_pos, 1.0));"),
+                                vtx_attr(config, GX_VA_POS), vtx_attr(config, GX_VA_NRM), projMtx);
+}
 
-  ShaderInfo info{
-      .uniformSize = 64 * 3, // mv, mvInv, proj
-  };
+static void tev_stage_info(const ShaderConfig& config, ShaderInfo& info) noexcept {
   for (int i = 0; i < config.tevStageCount; ++i) {
     const auto& stage = config.tevStages[i];
     // Color pass
@@ -581,7 +687,53 @@ ShaderInfo build_shader_info(const ShaderConfig& config) noexcept {
       info.writesTevReg.set(stage.alphaOp.outReg);
     }
   }
-  info.uniformSize += info.loadsTevReg.count() * 16;
+}
+
+void canonicalize_shader_config(ShaderConfig& config) noexcept {
+  ShaderInfo info;
+  tev_stage_info(config, info);
+  for (u32 i = config.tevStageCount; i < config.tevStages.size(); ++i) {
+    config.tevStages[i] = {};
+  }
+  for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
+    if (!info.sampledColorChannels.test(i)) {
+      config.colorChannels[i * 2] = {};
+      config.colorChannels[i * 2 + 1] = {};
+    }
+  }
+  for (auto& cc : config.colorChannels) {
+    if (!cc.lightingEnabled) {
+      // Only matSrc matters when lighting disabled
+      cc = {.matSrc = cc.matSrc};
+    }
+  }
+  for (int i = 0; i < info.sampledTexCoords.size(); ++i) {
+    if (!info.sampledTexCoords.test(i)) {
+      config.tcgs[i] = {};
+    }
+  }
+  for (int i = 0; i < info.sampledTextures.size(); ++i) {
+    if (!info.sampledTextures.test(i)) {
+      config.textureConfig[i] = {};
+    }
+  }
+}
+
+static ShaderInfo compute_shader_info(const ShaderConfig& config) noexcept {
+  if (config.ubershader) {
+    ShaderInfo info{
+        .sampledTextures = config.sampledTextures,
+        .uniformSize = align_uniform(sizeof(UberUniform)),
+    };
+    return info;
+  }
+
+  ShaderInfo info{
+      .uniformSize = 64 * 2,  // mv, mvInv
+      .frameUniformSize = 64, // proj
+  };
+  tev_stage_info(config, info);
+  info.materialUniformSize += info.loadsTevReg.count() * 16;
   bool lightingEnabled = false;
   for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
     if (info.sampledColorChannels.test(i)) {
@@ -594,27 +746,27 @@ ShaderInfo build_shader_info(const ShaderConfig& config) noexcept {
   }
   if (lightingEnabled) {
     // Lights + light state for all channels
-    info.uniformSize += 16 + (80 * GX::MaxLights);
+    info.frameUniformSize += 16 + (80 * config.lightCount);
   }
   for (int i = 0; i < info.sampledColorChannels.size(); ++i) {
     if (info.sampledColorChannels.test(i)) {
       const auto& cc = config.colorChannels[i * 2];
       if (cc.lightingEnabled && cc.ambSrc == GX_SRC_REG) {
-        info.uniformSize += 16;
+        info.materialUniformSize += 16;
       }
       if (cc.matSrc == GX_SRC_REG) {
-        info.uniformSize += 16;
+        info.materialUniformSize += 16;
       }
       const auto& cca = config.colorChannels[i * 2 + 1];
       if (cca.lightingEnabled && cca.ambSrc == GX_SRC_REG) {
-        info.uniformSize += 16;
+        info.materialUniformSize += 16;
       }
       if (cca.matSrc == GX_SRC_REG) {
-        info.uniformSize += 16;
+        info.materialUniformSize += 16;
       }
     }
   }
-  info.uniformSize += info.sampledKColors.count() * 16;
+  info.materialUniformSize += info.sampledKColors.count() * 16;
   for (int i = 0; i < info.sampledTexCoords.size(); ++i) {
     if (!info.sampledTexCoords.test(i)) {
       continue;
@@ -647,19 +799,399 @@ ShaderInfo build_shader_info(const ShaderConfig& config) noexcept {
   info.uniformSize += info.usesPTTexMtx.count() * 64;
   if (config.fogType != GX_FOG_NONE) {
     info.usesFog = true;
-    info.uniformSize += 32;
+    info.frameUniformSize += 32;
   }
-  info.uniformSize += info.sampledTextures.count() * 4;
-  info.uniformSize = align_uniform(info.uniformSize);
+  info.materialUniformSize += info.sampledTextures.count() * 4;
+  // The ubershader's fragment loop samples textures, which WGSL requires to be in uniform control flow, so it keeps
+  // the uniform binding; the flat storage index isn't uniform.
+  info.perDrawStorage = g_config.perDrawStorage;
+  info.uniformSize = ALIGN(info.uniformSize, 16);
+  info.frameUniformSize = ALIGN(info.frameUniformSize, 16);
+  info.materialUniformSize = ALIGN(info.materialUniformSize, 16);
   return info;
 }
 
-wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+ShaderInfo build_shader_info(const ShaderConfig& config) noexcept {
   const auto hash = xxh3_hash(config);
-  const auto it = g_gxCachedShaders.find(hash);
-  if (it != g_gxCachedShaders.end()) {
-    CHECK(g_gxCachedShaderConfigs[hash] == config, "Shader collision! {:x}", hash);
-    return it->second.first;
+  {
+    std::scoped_lock lock{g_gxShaderInfosMutex};
+    const auto it = g_gxShaderInfos.find(hash);
+    if (it != g_gxShaderInfos.end()) {
+      return it->second;
+    }
+  }
+  auto info = compute_shader_info(config);
+  info.shaderHash = hash;
+  std::scoped_lock lock{g_gxShaderInfosMutex};
+  g_gxShaderInfos.try_emplace(hash, info);
+  return info;
+}
+
+static wgpu::ShaderModule create_shader(ShaderRef hash, const ShaderConfig& config, const ShaderInfo& info,
+                                        std::string shaderSource) noexcept {
+  if (EnableDebugPrints) {
+    Log.report(LOG_INFO, FMT_STRING("Generated shader: {}"), shaderSource);
+  }
+
+  wgpu::ShaderModuleWGSLDescriptor wgslDescriptor{};
+  wgslDescriptor.source = shaderSource.c_str();
+  const auto label = fmt::format(FMT_STRING("GX Shader {:x}"), hash);
+  const auto shaderDescriptor = wgpu::ShaderModuleDescriptor{
+      .nextInChain = &wgslDescriptor,
+      .label = label.c_str(),
+  };
+  auto shader = webgpu::g_device.CreateShaderModule(&shaderDescriptor);
+
+  // Another thread may have built the same shader in the meantime
+  std::scoped_lock lock{g_gxCachedShadersMutex};
+  const auto [it, inserted] = g_gxCachedShaders.try_emplace(hash, shader, info);
+#ifndef NDEBUG
+  if (inserted) {
+    g_gxCachedShaderConfigs.emplace(hash, config);
+  }
+#endif
+  return it->second.first;
+}
+
+// Generic shader used while a specialized pipeline is still compiling. The TEV, lighting, texgen & fog state
+// is read from the uniform (see UberUniform), so only the vertex format & texture bindings select a variant.
+static std::string build_ubershader_source(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+  std::string uniformBindings;
+  std::string vtxInAttrs;
+  std::string vtxXfrAttrsPre;
+  build_vtx_inputs(config, vtxInAttrs, vtxXfrAttrsPre, uniformBindings, 1, "ubuf.proj");
+
+  std::string vtxXfrAttrs;
+  for (int i = 0; i < 2; ++i) {
+    const auto attr = static_cast<GXAttr>(GX_VA_CLR0 + i);
+    vtxXfrAttrs += fmt::format(FMT_STRING("\n    out.clr{} = {};"), i,
+                               config.vtxAttrs[attr] == GX_NONE ? "vec4<f32>(1.0)"s : vtx_attr(config, attr));
+  }
+  std::string tcgSrcCases;
+  tcgSrcCases += fmt::format(FMT_STRING("\n            case {}u: {{ tc = vec4<f32>({}, 1.0); }}"), GX_TG_POS,
+                             vtx_attr(config, GX_VA_POS));
+  tcgSrcCases += fmt::format(FMT_STRING("\n            case {}u: {{ tc = vec4<f32>({}, 1.0); }}"), GX_TG_NRM,
+                             vtx_attr(config, GX_VA_NRM));
+  for (int i = 0; i < 8; ++i) {
+    const auto attr = static_cast<GXAttr>(GX_VA_TEX0 + i);
+    if (config.vtxAttrs[attr] == GX_NONE) {
+      continue;
+    }
+    tcgSrcCases += fmt::format(FMT_STRING("\n            case {}u: {{ tc = vec4<f32>({}, 0.0, 1.0); }}"),
+                               GX_TG_TEX0 + i, vtx_attr(config, attr));
+  }
+
+  std::string sampBindings;
+  std::string texBindings;
+  std::string sampleCases;
+  size_t texBindIdx = 0;
+  for (int i = 0; i < info.sampledTextures.size(); ++i) {
+    if (!info.sampledTextures.test(i)) {
+      continue;
+    }
+    sampBindings += fmt::format(FMT_STRING("\n@group(1) @binding({})\n"
+                                           "var tex{}_samp: sampler;"),
+                                texBindIdx, i);
+    texBindings += fmt::format(FMT_STRING("\n@group(2) @binding({})\n"
+                                          "var tex{}: texture_2d<f32>;"),
+                               texBindIdx, i);
+    ++texBindIdx;
+    sampleCases += fmt::format(
+        FMT_STRING("\n        case {0}u: {{"
+                   "\n    var sampled0 = textureSampleBias(tex{0}, tex{0}_samp, uv, ubuf.tex_lod[{1}][{2}]);{3}"
+                   "\n    return sampled0;"
+                   "\n        }}"),
+        i, i / 4, i % 4, texture_conversion(config.textureConfig[i], 0, i));
+  }
+
+  return fmt::format(FMT_STRING(R"""({0}
+struct Light {{
+    pos: vec3<f32>,
+    dir: vec3<f32>,
+    color: vec4<f32>,
+    cos_att: vec3<f32>,
+    dist_att: vec3<f32>,
+}};
+struct Fog {{
+    color: vec4<f32>,
+    a: f32,
+    b: f32,
+    c: f32,
+    pad: f32,
+}};
+struct TexGen {{
+    mtx: array<vec4<f32>, 3>,
+    post_mtx: array<vec4<f32>, 3>,
+    src: u32,
+    norm: u32,
+}};
+struct Uniform {{
+    pos_mtx: mtx4x3,
+    nrm_mtx: mtx4x3,
+    proj: mtx4x4,
+    tev_regs: array<vec4<f32>, 4>,
+    kcolors: array<vec4<f32>, 4>,
+    amb_colors: array<vec4<f32>, 4>,
+    mat_colors: array<vec4<f32>, 4>,
+    lights: array<Light, 8>,
+    light_state: vec4<u32>,
+    tex_gens: array<TexGen, 8>,
+    fog: Fog,
+    tex_lod: array<vec4<f32>, 2>,
+    stages: array<vec4<u32>, 16>,
+    swap_table: array<vec4<u32>, 4>,
+    channels: array<vec4<u32>, 2>,
+    misc: vec4<u32>,
+}};
+@group(0) @binding(0)
+var<uniform> ubuf: Uniform;{1}{2}{3}
+
+struct VertexOutput {{
+    @builtin(position) pos: vec4<f32>,
+    @location(0) mv_pos: vec3<f32>,
+    @location(1) mv_nrm: vec3<f32>,
+    @location(2) clr0: vec4<f32>,
+    @location(3) clr1: vec4<f32>,
+    @location(4) tex01: vec4<f32>,
+    @location(5) tex23: vec4<f32>,
+    @location(6) tex45: vec4<f32>,
+    @location(7) tex67: vec4<f32>,
+}};
+
+var<private> tev_regs: array<vec4<f32>, 4>;
+var<private> tev_tex: vec4<f32>;
+var<private> tev_ras: vec4<f32>;
+
+fn intensityF32(rgb: vec3<f32>) -> f32 {{
+    return dot(rgb, vec3(0.257, 0.504, 0.098)) + 16.0 / 255.0;
+}}
+fn sample_tex(id: u32, uv: vec2<f32>) -> vec4<f32> {{
+    switch id {{{4}
+        default: {{ return vec4<f32>(0.0); }}
+    }}
+}}
+fn konst_color(sel: u32) -> vec3<f32> {{
+    if (sel < 8u) {{ return vec3<f32>(f32(8u - sel) / 8.0); }}
+    if (sel < 16u) {{ return ubuf.kcolors[sel - 12u].rgb; }}
+    return vec3<f32>(ubuf.kcolors[(sel - 16u) % 4u][(sel - 16u) / 4u]);
+}}
+fn konst_alpha(sel: u32) -> f32 {{
+    if (sel < 8u) {{ return f32(8u - sel) / 8.0; }}
+    return ubuf.kcolors[(sel - 16u) % 4u][(sel - 16u) / 4u];
+}}
+fn tev_color_arg(arg: u32, konst: vec3<f32>) -> vec3<f32> {{
+    switch arg {{
+        case 0u, 2u, 4u, 6u: {{ return tev_regs[arg / 2u].rgb; }}
+        case 1u, 3u, 5u, 7u: {{ return vec3<f32>(tev_regs[arg / 2u].a); }}
+        case 8u: {{ return tev_tex.rgb; }}
+        case 9u: {{ return vec3<f32>(tev_tex.a); }}
+        case 10u: {{ return tev_ras.rgb; }}
+        case 11u: {{ return vec3<f32>(tev_ras.a); }}
+        case 12u: {{ return vec3<f32>(1.0); }}
+        case 13u: {{ return vec3<f32>(0.5); }}
+        case 14u: {{ return konst; }}
+        default: {{ return vec3<f32>(0.0); }}
+    }}
+}}
+fn tev_alpha_arg(arg: u32, konst: f32) -> f32 {{
+    switch arg {{
+        case 0u, 1u, 2u, 3u: {{ return tev_regs[arg].a; }}
+        case 4u: {{ return tev_tex.a; }}
+        case 5u: {{ return tev_ras.a; }}
+        case 6u: {{ return konst; }}
+        default: {{ return 0.0; }}
+    }}
+}}
+fn tev_bias(op: u32) -> f32 {{
+    switch (op >> 1u) & 3u {{
+        case 1u: {{ return 0.5; }}
+        case 2u: {{ return -0.5; }}
+        default: {{ return 0.0; }}
+    }}
+}}
+fn tev_scale(op: u32) -> f32 {{
+    switch (op >> 3u) & 3u {{
+        case 1u: {{ return 2.0; }}
+        case 2u: {{ return 4.0; }}
+        case 3u: {{ return 0.5; }}
+        default: {{ return 1.0; }}
+    }}
+}}
+fn tev_sign(op: u32) -> f32 {{
+    return select(1.0, -1.0, (op & 1u) != 0u);
+}}
+fn swizzle(v: vec4<f32>, swap: vec4<u32>) -> vec4<f32> {{
+    return vec4<f32>(v[swap.x], v[swap.y], v[swap.z], v[swap.w]);
+}}
+fn alpha_test(comp: u32, ref_val: f32, alpha: f32) -> bool {{
+    switch comp {{
+        case 0u: {{ return false; }}
+        case 1u: {{ return alpha < ref_val; }}
+        case 2u: {{ return alpha == ref_val; }}
+        case 3u: {{ return alpha <= ref_val; }}
+        case 4u: {{ return alpha > ref_val; }}
+        case 5u: {{ return alpha != ref_val; }}
+        case 6u: {{ return alpha >= ref_val; }}
+        default: {{ return true; }}
+    }}
+}}
+
+@vertex
+fn vs_main({5}
+) -> VertexOutput {{
+    var out: VertexOutput;{6}
+    out.mv_pos = mv_pos;
+    out.mv_nrm = mv_nrm;{7}
+    var uvs: array<vec2<f32>, 8>;
+    for (var i = 0u; i < 8u; i++) {{
+        let tcg = ubuf.tex_gens[i];
+        var tc = vec4<f32>(0.0);
+        switch tcg.src {{{8}
+            default: {{}}
+        }}
+        var tmp = vec3<f32>(dot(tcg.mtx[0], tc), dot(tcg.mtx[1], tc), dot(tcg.mtx[2], tc));
+        if (tcg.norm != 0u) {{ tmp = normalize(tmp); }}
+        let proj = vec4<f32>(tmp, 1.0);
+        uvs[i] = vec2<f32>(dot(tcg.post_mtx[0], proj), dot(tcg.post_mtx[1], proj));
+    }}
+    out.tex01 = vec4<f32>(uvs[0], uvs[1]);
+    out.tex23 = vec4<f32>(uvs[2], uvs[3]);
+    out.tex45 = vec4<f32>(uvs[4], uvs[5]);
+    out.tex67 = vec4<f32>(uvs[6], uvs[7]);
+    return out;
+}}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {{
+    var rast: array<vec4<f32>, 2>;
+    for (var i = 0u; i < 2u; i++) {{
+        let chan = ubuf.channels[i];
+        let vtx_color = select(in.clr0, in.clr1, (chan.w >> 16u) == 1u);
+        let mat_color = select(ubuf.mat_colors[i * 2u], vtx_color, chan.z == 1u);
+        if (chan.x == 0u) {{
+            rast[i] = mat_color;
+            continue;
+        }}
+        var lighting = select(ubuf.amb_colors[i * 2u], vtx_color, chan.y == 1u);
+        let diff_fn = chan.w & 0xFFu;
+        let attn_fn = (chan.w >> 8u) & 0xFFu;
+        for (var j = 0u; j < 8u; j++) {{
+            if ((ubuf.light_state[i * 2u] & (1u << j)) == 0u) {{ continue; }}
+            let light = ubuf.lights[j];
+            var ldir = light.pos - in.mv_pos;
+            let dist2 = dot(ldir, ldir);
+            let dist = sqrt(dist2);
+            ldir = ldir / dist;
+            var attn = 1.0;
+            if (attn_fn == 1u) {{
+                let cosine = max(0.0, dot(ldir, light.dir));
+                let cos_attn = dot(light.cos_att, vec3<f32>(1.0, cosine, cosine * cosine));
+                let dist_attn = dot(light.dist_att, vec3<f32>(1.0, dist, dist2));
+                attn = max(0.0, cos_attn / dist_attn);
+            }}
+            var diff = 1.0;
+            if (diff_fn == 1u) {{
+                diff = dot(ldir, in.mv_nrm);
+            }} else if (diff_fn == 2u) {{
+                diff = max(0.0, dot(ldir, in.mv_nrm));
+            }}
+            lighting = lighting + (attn * diff * light.color);
+        }}
+        rast[i] = vec4<f32>((mat_color * clamp(lighting, vec4<f32>(0.0), vec4<f32>(1.0))).xyz, mat_color.a);
+    }}
+
+    var uvs = array<vec2<f32>, 8>(in.tex01.xy, in.tex01.zw, in.tex23.xy, in.tex23.zw,
+                                  in.tex45.xy, in.tex45.zw, in.tex67.xy, in.tex67.zw);
+    tev_regs = ubuf.tev_regs;
+    for (var i = 0u; i < ubuf.misc.x; i++) {{
+        let stage = ubuf.stages[i];
+        let tex_coord = stage.z & 0xFFu;
+        let tex_map = (stage.z >> 8u) & 0xFFu;
+        let channel = (stage.z >> 16u) & 0xFFu;
+        if (tex_map != 0xFFu) {{
+            tev_tex = swizzle(sample_tex(tex_map, uvs[tex_coord]), ubuf.swap_table[stage.z >> 28u]);
+        }}
+        var ras = vec4<f32>(0.0);
+        if (channel < 2u) {{
+            ras = rast[channel];
+        }}
+        tev_ras = swizzle(ras, ubuf.swap_table[(stage.z >> 24u) & 0xFu]);
+
+        let color_op = stage.y & 0xFFu;
+        let ca = tev_color_arg(stage.x & 0xFu, konst_color((stage.y >> 16u) & 0xFFu));
+        let cb = tev_color_arg((stage.x >> 4u) & 0xFu, konst_color((stage.y >> 16u) & 0xFFu));
+        let cc = tev_color_arg((stage.x >> 8u) & 0xFu, konst_color((stage.y >> 16u) & 0xFFu));
+        let cd = tev_color_arg((stage.x >> 12u) & 0xFu, konst_color((stage.y >> 16u) & 0xFFu));
+        var color = (tev_sign(color_op) * mix(ca, cb, cc) + cd + vec3<f32>(tev_bias(color_op))) * tev_scale(color_op);
+        if ((color_op & 0x80u) != 0u) {{
+            color = clamp(color, vec3<f32>(0.0), vec3<f32>(1.0));
+        }}
+        let color_reg = (color_op >> 5u) & 3u;
+        tev_regs[color_reg] = vec4<f32>(color, tev_regs[color_reg].a);
+
+        let alpha_op = (stage.y >> 8u) & 0xFFu;
+        let ka = konst_alpha(stage.y >> 24u);
+        let aa = tev_alpha_arg((stage.x >> 16u) & 7u, ka);
+        let ab = tev_alpha_arg((stage.x >> 19u) & 7u, ka);
+        let ac = tev_alpha_arg((stage.x >> 22u) & 7u, ka);
+        let ad = tev_alpha_arg((stage.x >> 25u) & 7u, ka);
+        var alpha = (tev_sign(alpha_op) * mix(aa, ab, ac) + ad + tev_bias(alpha_op)) * tev_scale(alpha_op);
+        if ((alpha_op & 0x80u) != 0u) {{
+            alpha = clamp(alpha, 0.0, 1.0);
+        }}
+        tev_regs[(alpha_op >> 5u) & 3u].a = alpha;
+    }}
+    var prev = tev_regs[0];
+
+    let fog_type = ubuf.misc.y & 7u;
+    if (fog_type != 0u) {{
+        var fogF = clamp((ubuf.fog.a / (ubuf.fog.b - in.pos.z)) - ubuf.fog.c, 0.0, 1.0);
+        var fogZ = fogF;
+        if (fog_type == 4u) {{
+            fogZ = 1.0 - exp2(-8.0 * fogF);
+        }} else if (fog_type == 5u) {{
+            fogZ = 1.0 - exp2(-8.0 * fogF * fogF);
+        }} else if (fog_type == 6u) {{
+            fogZ = exp2(-8.0 * (1.0 - fogF));
+        }} else if (fog_type == 7u) {{
+            fogF = 1.0 - fogF;
+            fogZ = exp2(-8.0 * fogF * fogF);
+        }}
+        prev = vec4<f32>(mix(prev.rgb, ubuf.fog.color.rgb, clamp(fogZ, 0.0, 1.0)), prev.a);
+    }}
+
+    let alpha_compare = ubuf.misc.z;
+    if ((alpha_compare & 0x80000000u) != 0u) {{
+        let comp0 = alpha_test(alpha_compare & 7u, f32((alpha_compare >> 8u) & 0xFFu) / 255.0, prev.a);
+        let comp1 = alpha_test((alpha_compare >> 3u) & 7u, f32((alpha_compare >> 16u) & 0xFFu) / 255.0, prev.a);
+        var passed = true;
+        switch (alpha_compare >> 6u) & 3u {{
+            case 0u: {{ passed = comp0 && comp1; }}
+            case 1u: {{ passed = comp0 || comp1; }}
+            case 2u: {{ passed = comp0 != comp1; }}
+            default: {{ passed = comp0 == comp1; }}
+        }}
+        if (!passed) {{ discard; }}
+    }}
+    return prev;
+}}
+)"""),
+                     MatrixFns, uniformBindings, sampBindings, texBindings, sampleCases, vtxInAttrs, vtxXfrAttrsPre,
+                     vtxXfrAttrs, tcgSrcCases);
+}
+
+wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& info) noexcept {
+  const auto hash = info.shaderHash;
+  {
+    std::scoped_lock lock{g_gxCachedShadersMutex};
+    const auto it = g_gxCachedShaders.find(hash);
+    if (it != g_gxCachedShaders.end()) {
+      CHECK(g_gxCachedShaderConfigs[hash] == config, "Shader collision! {:x}", hash);
+      return it->second.first;
+    }
+  }
+  if (config.ubershader) {
+    return create_shader(hash, config, info, build_ubershader_source(config, info));
   }
 
   if (EnableDebugPrints) {
@@ -714,6 +1246,8 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
 
   std::string uniformPre;
   std::string uniBufAttrs;
+  std::string frameBufAttrs;
+  std::string materialBufAttrs;
   std::string uniformBindings;
   std::string sampBindings;
   std::string texBindings;
@@ -721,89 +1255,10 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
   std::string vtxInAttrs;
   std::string vtxXfrAttrsPre;
   std::string vtxXfrAttrs;
-  size_t locIdx = 0;
   size_t vtxOutIdx = 0;
-  size_t uniBindingIdx = 1;
-  if (config.indexedAttributeCount > 0) {
-    // Display list attributes
-    int currAttrIdx = 0;
-    for (GXAttr attr{}; attr < MaxVtxAttr; attr = GXAttr(attr + 1)) {
-      // Indexed attributes
-      if (config.vtxAttrs[attr] != GX_INDEX8 && config.vtxAttrs[attr] != GX_INDEX16) {
-        continue;
-      }
-      const auto [div, rem] = std::div(currAttrIdx, 4);
-      std::string_view attrName;
-      bool addUniformBinding = true;
-      if (config.attrMapping[attr] != attr) {
-        attrName = VtxAttributeNames[config.attrMapping[attr]];
-        addUniformBinding = false;
-      } else {
-        attrName = VtxAttributeNames[attr];
-      }
-      vtxXfrAttrsPre +=
-          fmt::format(FMT_STRING("\n    var {} = v_arr_{}[in_dl{}[{}]];"), vtx_attr(config, attr), attrName, div, rem);
-      if (addUniformBinding) {
-        std::string_view arrType;
-        if (attr == GX_VA_POS || attr == GX_VA_NRM) {
-          arrType = "vec3<f32>";
-        } else if (attr >= GX_VA_TEX0 && attr <= GX_VA_TEX7) {
-          arrType = "vec2<f32>";
-        }
-        uniformBindings += fmt::format(FMT_STRING("\n@group(0) @binding({})"
-                                                  "\nvar<storage, read> v_arr_{}: array<{}>;"),
-                                       uniBindingIdx++, attrName, arrType);
-      }
-      ++currAttrIdx;
-    }
-    auto [num4xAttrArrays, rem] = std::div(currAttrIdx, 4);
-    u32 num2xAttrArrays = 0;
-    if (rem > 2) {
-      ++num4xAttrArrays;
-    } else if (rem > 0) {
-      num2xAttrArrays = 1;
-    }
-    for (u32 i = 0; i < num4xAttrArrays; ++i) {
-      if (locIdx > 0) {
-        vtxInAttrs += "\n    , ";
-      } else {
-        vtxInAttrs += "\n    ";
-      }
-      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_dl{}: vec4<i32>"), locIdx++, i);
-    }
-    for (u32 i = 0; i < num2xAttrArrays; ++i) {
-      if (locIdx > 0) {
-        vtxInAttrs += "\n    , ";
-      } else {
-        vtxInAttrs += "\n    ";
-      }
-      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_dl{}: vec2<i32>"), locIdx++, num4xAttrArrays + i);
-    }
-  }
-  for (GXAttr attr{}; attr < MaxVtxAttr; attr = GXAttr(attr + 1)) {
-    // Direct attributes
-    if (config.vtxAttrs[attr] != GX_DIRECT) {
-      continue;
-    }
-    if (locIdx > 0) {
-      vtxInAttrs += "\n    , ";
-    } else {
-      vtxInAttrs += "\n    ";
-    }
-    if (attr == GX_VA_POS) {
-      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_pos: vec3<f32>"), locIdx++);
-    } else if (attr == GX_VA_NRM) {
-      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_nrm: vec3<f32>"), locIdx++);
-    } else if (attr == GX_VA_CLR0 || attr == GX_VA_CLR1) {
-      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_clr{}: vec4<f32>"), locIdx++, attr - GX_VA_CLR0);
-    } else if (attr >= GX_VA_TEX0 && attr <= GX_VA_TEX7) {
-      vtxInAttrs += fmt::format(FMT_STRING("@location({}) in_tex{}_uv: vec2<f32>"), locIdx++, attr - GX_VA_TEX0);
-    }
-  }
-  vtxXfrAttrsPre += fmt::format(FMT_STRING("\n    var mv_pos = mul4x3(ubuf.pos_mtx, vec4<f32>({}, 1.0));"
-                                           "\n    var mv_nrm = normalize(mul4x3(ubuf.nrm_mtx, vec4<f32>({}, 0.0)));"
-                                           "\n    out.pos = mul4x4(ubuf.proj, vec4<f32>(mv_pos, 1.0));"),
-                                vtx_attr(config, GX_VA_POS), vtx_attr(config, GX_VA_NRM));
+  // Storage bindings follow ubuf, fbuf & mbuf (if used)
+  build_vtx_inputs(config, vtxInAttrs, vtxXfrAttrsPre, uniformBindings, info.materialUniformSize > 0 ? 3 : 2,
+                   "fbuf.proj");
   if constexpr (EnableNormalVisualization) {
     vtxOutAttrs += fmt::format(FMT_STRING("\n    @location({}) nrm: vec3<f32>,"), vtxOutIdx++);
     vtxXfrAttrsPre += "\n    out.nrm = mv_nrm;";
@@ -870,15 +1325,15 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
     }
   }
   if (info.loadsTevReg.test(0)) {
-    uniBufAttrs += "\n    tevprev: vec4<f32>,";
-    fragmentFnPre += "\n    var prev = ubuf.tevprev;";
+    materialBufAttrs += "\n    tevprev: vec4<f32>,";
+    fragmentFnPre += "\n    var prev = mbuf.tevprev;";
   } else {
     fragmentFnPre += "\n    var prev: vec4<f32>;";
   }
   for (int i = 1 /* Skip TEVPREV */; i < info.loadsTevReg.size(); ++i) {
     if (info.loadsTevReg.test(i)) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    tevreg{}: vec4<f32>,"), i - 1);
-      fragmentFnPre += fmt::format(FMT_STRING("\n    var tevreg{0} = ubuf.tevreg{0};"), i - 1);
+      materialBufAttrs += fmt::format(FMT_STRING("\n    tevreg{}: vec4<f32>,"), i - 1);
+      fragmentFnPre += fmt::format(FMT_STRING("\n    var tevreg{0} = mbuf.tevreg{0};"), i - 1);
     } else if (info.writesTevReg.test(i)) {
       fragmentFnPre += fmt::format(FMT_STRING("\n    var tevreg{0}: vec4<f32>;"), i - 1);
     }
@@ -893,12 +1348,12 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
     const auto& cca = config.colorChannels[i * 2 + 1];
 
     if (!addedLightStruct && (cc.lightingEnabled || cca.lightingEnabled)) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    lights: array<Light, {}>,"
-                                            "\n    lightState0: u32,"
-                                            "\n    lightState0a: u32,"
-                                            "\n    lightState1: u32,"
-                                            "\n    lightState1a: u32,"),
-                                 GX::MaxLights);
+      frameBufAttrs += fmt::format(FMT_STRING("\n    lights: array<Light, {}>,"
+                                              "\n    lightState0: u32,"
+                                              "\n    lightState0a: u32,"
+                                              "\n    lightState1: u32,"
+                                              "\n    lightState1a: u32,"),
+                                   config.lightCount);
       uniformPre +=
           "\n"
           "struct Light {\n"
@@ -919,16 +1374,16 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
     }
 
     if (cc.lightingEnabled && cc.ambSrc == GX_SRC_REG) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    cc{0}_amb: vec4<f32>,"), i);
+      materialBufAttrs += fmt::format(FMT_STRING("\n    cc{0}_amb: vec4<f32>,"), i);
     }
     if (cc.matSrc == GX_SRC_REG) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    cc{0}_mat: vec4<f32>,"), i);
+      materialBufAttrs += fmt::format(FMT_STRING("\n    cc{0}_mat: vec4<f32>,"), i);
     }
     if (cca.lightingEnabled && cca.ambSrc == GX_SRC_REG) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    cc{0}a_amb: vec4<f32>,"), i);
+      materialBufAttrs += fmt::format(FMT_STRING("\n    cc{0}a_amb: vec4<f32>,"), i);
     }
     if (cca.matSrc == GX_SRC_REG) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    cc{0}a_mat: vec4<f32>,"), i);
+      materialBufAttrs += fmt::format(FMT_STRING("\n    cc{0}a_mat: vec4<f32>,"), i);
     }
 
     // Output vertex color if necessary
@@ -953,7 +1408,7 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
           ambSrc = vtx_attr(config, static_cast<GXAttr>(GX_VA_CLR0 + vtxColorIdx));
         }
       } else if (cc.ambSrc == GX_SRC_REG) {
-        ambSrc = fmt::format(FMT_STRING("ubuf.cc{0}_amb"), i);
+        ambSrc = fmt::format(FMT_STRING("mbuf.cc{0}_amb"), i);
       }
       if (cc.matSrc == GX_SRC_VTX) {
         if (UsePerPixelLighting) {
@@ -962,7 +1417,7 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
           matSrc = vtx_attr(config, static_cast<GXAttr>(GX_VA_CLR0 + vtxColorIdx));
         }
       } else if (cc.matSrc == GX_SRC_REG) {
-        matSrc = fmt::format(FMT_STRING("ubuf.cc{0}_mat"), i);
+        matSrc = fmt::format(FMT_STRING("mbuf.cc{0}_mat"), i);
       }
       GXDiffuseFn diffFn = cc.diffFn;
       if (cc.attnFn == GX_AF_NONE) {
@@ -1004,20 +1459,21 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
     {{
       var lighting = {5};
       for (var i = 0u; i < {1}u; i++) {{
-          if ((ubuf.lightState{0} & (1u << i)) == 0u) {{ continue; }}
-          var light = ubuf.lights[i];
-          var ldir = light.pos - {7};
-          var dist2 = dot(ldir, ldir);
-          var dist = sqrt(dist2);
-          ldir = ldir / dist;
-          var attn: f32;{2}
-          var diff = {3};
-          lighting = lighting + (attn * diff * light.color);
+          if ((fbuf.lightState{0} & (1u << i)) != 0u) {{
+            var light = fbuf.lights[i];
+            var ldir = light.pos - {7};
+            var dist2 = dot(ldir, ldir);
+            var dist = sqrt(dist2);
+            ldir = ldir / dist;
+            var attn: f32;{2}
+            var diff = {3};
+            lighting = lighting + (attn * diff * light.color);
+          }}
       }}
       // TODO alpha lighting
       {6} = vec4<f32>(({4} * clamp(lighting, vec4<f32>(0.0), vec4<f32>(1.0))).xyz, {4}.a);
     }})"""),
-                                   i, GX::MaxLights, lightAttnFn, lightDiffFn, matSrc, ambSrc, outVar, posVar);
+                                   i, config.lightCount, lightAttnFn, lightDiffFn, matSrc, ambSrc, outVar, posVar);
       if (UsePerPixelLighting) {
         fragmentFnPre += fmt::format(FMT_STRING("\n    var rast{}: vec4<f32>;"), i);
         fragmentFnPre += lightFunc;
@@ -1037,7 +1493,7 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
         fragmentFnPre += fmt::format(FMT_STRING("\n    var rast{0} = in.cc{0};"), i);
       }
     } else {
-      fragmentFnPre += fmt::format(FMT_STRING("\n    var rast{0} = ubuf.cc{0}_mat;"), i);
+      fragmentFnPre += fmt::format(FMT_STRING("\n    var rast{0} = mbuf.cc{0}_mat;"), i);
     }
 
     if (usesVtxColor) {
@@ -1046,7 +1502,7 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
   }
   for (int i = 0; i < info.sampledKColors.size(); ++i) {
     if (info.sampledKColors.test(i)) {
-      uniBufAttrs += fmt::format(FMT_STRING("\n    kcolor{}: vec4<f32>,"), i);
+      materialBufAttrs += fmt::format(FMT_STRING("\n    kcolor{}: vec4<f32>,"), i);
     }
   }
   for (int i = 0; i < info.sampledTexCoords.size(); ++i) {
@@ -1083,7 +1539,7 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
     }
     vtxXfrAttrs += fmt::format(FMT_STRING("\n    out.tex{0}_uv = tc{0}_proj.xy;"), i);
   }
-  for (int i = 0; i < config.tevStages.size(); ++i) {
+  for (int i = 0; i < config.tevStageCount; ++i) {
     const auto& stage = config.tevStages[i];
     if (stage.texMapId == GX_TEXMAP_NULL ||
         stage.texCoordId == GX_TEXCOORD_NULL
@@ -1114,7 +1570,7 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
                       i, stage.texMapId, uvIn, suffix);
     } else {
       fragmentFnPre += fmt::format(
-          FMT_STRING("\n    var sampled{0} = textureSampleBias(tex{1}, tex{1}_samp, {2}, ubuf.tex{1}_lod);"), i,
+          FMT_STRING("\n    var sampled{0} = textureSampleBias(tex{1}, tex{1}_samp, {2}, mbuf.tex{1}_lod);"), i,
           stage.texMapId, uvIn);
     }
     fragmentFnPre += texture_conversion(texConfig, i, stage.texMapId);
@@ -1147,9 +1603,9 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
         "    c: f32,\n"
         "    pad: f32,\n"
         "}";
-    uniBufAttrs += "\n    fog: Fog,";
+    frameBufAttrs += "\n    fog: Fog,";
 
-    fragmentFn += "\n    // Fog\n    var fogF = clamp((ubuf.fog.a / (ubuf.fog.b - in.pos.z)) - ubuf.fog.c, 0.0, 1.0);";
+    fragmentFn += "\n    // Fog\n    var fogF = clamp((fbuf.fog.a / (fbuf.fog.b - in.pos.z)) - fbuf.fog.c, 0.0, 1.0);";
     switch (config.fogType) {
       DEFAULT_FATAL("invalid fog type {}", static_cast<int>(config.fogType));
     case GX_FOG_PERSP_LIN:
@@ -1175,14 +1631,14 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
           "\n    var fogZ = exp2(-8.0 * fogF * fogF);";
       break;
     }
-    fragmentFn += "\n    prev = vec4<f32>(mix(prev.rgb, ubuf.fog.color.rgb, clamp(fogZ, 0.0, 1.0)), prev.a);";
+    fragmentFn += "\n    prev = vec4<f32>(mix(prev.rgb, fbuf.fog.color.rgb, clamp(fogZ, 0.0, 1.0)), prev.a);";
   }
   size_t texBindIdx = 0;
   for (int i = 0; i < info.sampledTextures.size(); ++i) {
     if (!info.sampledTextures.test(i)) {
       continue;
     }
-    uniBufAttrs += fmt::format(FMT_STRING("\n    tex{}_lod: f32,"), i);
+    materialBufAttrs += fmt::format(FMT_STRING("\n    tex{}_lod: f32,"), i);
 
     sampBindings += fmt::format(FMT_STRING("\n@group(1) @binding({})\n"
                                            "var tex{}_samp: sampler;"),
@@ -1232,36 +1688,45 @@ wgpu::ShaderModule build_shader(const ShaderConfig& config, const ShaderInfo& in
   if constexpr (EnableNormalVisualization) {
     fragmentFn += "\n    prev = vec4<f32>(in.nrm, prev.a);";
   }
+  std::string drawBinding;
+  if (info.perDrawStorage) {
+    // The draw's Uniform block is an element of a tightly packed storage array, indexed by its first instance
+    // instead of a dynamic uniform offset. Only the vertex stage reads it.
+    // @size fixes the array stride to the CPU-side block size.
+    drawBinding = fmt::format(FMT_STRING("struct DrawData {{\n"
+                                         "    @size({}) ubuf: Uniform,\n"
+                                         "}};\n"
+                                         "@group(0) @binding(0)\n"
+                                         "var<storage, read> draws: array<DrawData>;"),
+                              info.uniformSize);
+    vtxInAttrs += vtxInAttrs.empty() ? "\n    " : "\n    , ";
+    vtxInAttrs += "@builtin(instance_index) instance_idx: u32";
+    vtxXfrAttrsPre.insert(0, "\n    let ubuf = draws[instance_idx].ubuf;");
+  } else {
+    drawBinding = "@group(0) @binding(0)\n"
+                  "var<uniform> ubuf: Uniform;";
+  }
+  if (!materialBufAttrs.empty()) {
+    uniformPre += fmt::format(FMT_STRING("\n"
+                                         "struct MaterialUniform {{{}\n"
+                                         "}};\n"
+                                         "@group(0) @binding(2)\n"
+                                         "var<uniform> mbuf: MaterialUniform;"),
+                              materialBufAttrs);
+  }
 
   const auto shaderSource = fmt::format(FMT_STRING(R"""(
-struct mtx4x4 {{ mx: vec4<f32>, my: vec4<f32>, mz: vec4<f32>, mw: vec4<f32> }};
-struct mtx4x3 {{ mx: vec4<f32>, my: vec4<f32>, mz: vec4<f32>, mw: vec4<f32> }};
-struct mtx4x2 {{ mx: vec4<f32>, my: vec4<f32>, }};
-// TODO convert these to row major
-fn mul4x4(m: mtx4x4, v: vec4<f32>) -> vec4<f32> {{
-  var mx = vec4<f32>(m.mx.x, m.my.x, m.mz.x, m.mw.x);
-  var my = vec4<f32>(m.mx.y, m.my.y, m.mz.y, m.mw.y);
-  var mz = vec4<f32>(m.mx.z, m.my.z, m.mz.z, m.mw.z);
-  var mw = vec4<f32>(m.mx.w, m.my.w, m.mz.w, m.mw.w);
-  return vec4<f32>(dot(mx, v), dot(my, v), dot(mz, v), dot(mw, v));
-}}
-fn mul4x3(m: mtx4x3, v: vec4<f32>) -> vec3<f32> {{
-  var mx = vec4<f32>(m.mx.x, m.my.x, m.mz.x, m.mw.x);
-  var my = vec4<f32>(m.mx.y, m.my.y, m.mz.y, m.mw.y);
-  var mz = vec4<f32>(m.mx.z, m.my.z, m.mz.z, m.mw.z);
-  return vec3<f32>(dot(mx, v), dot(my, v), dot(mz, v));
-}}
-fn mul4x2(m: mtx4x2, v: vec4<f32>) -> vec2<f32> {{
-  return vec2<f32>(dot(m.mx, v), dot(m.my, v));
-}}
-{10}
+{11}{10}
 struct Uniform {{
     pos_mtx: mtx4x3,
-    nrm_mtx: mtx4x3,
-    proj: mtx4x4,{0}
+    nrm_mtx: mtx4x3,{0}
 }};
-@group(0) @binding(0)
-var<uniform> ubuf: Uniform;{3}{1}{2}
+{13}
+struct FrameUniform {{
+    proj: mtx4x4,{12}
+}};
+@group(0) @binding(1)
+var<uniform> fbuf: FrameUniform;{3}{1}{2}
 
 struct VertexOutput {{
     @builtin(position) pos: vec4<f32>,{4}
@@ -1324,26 +1789,8 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {{{8}{7}
 }}
 )"""),
                                         uniBufAttrs, sampBindings, texBindings, uniformBindings, vtxOutAttrs,
-                                        vtxInAttrs, vtxXfrAttrs, fragmentFn, fragmentFnPre, vtxXfrAttrsPre, uniformPre);
-  if (EnableDebugPrints) {
-    Log.report(LOG_INFO, FMT_STRING("Generated shader: {}"), shaderSource);
-  }
-
-  wgpu::ShaderModuleWGSLDescriptor wgslDescriptor{};
-  wgslDescriptor.source = shaderSource.c_str();
-  const auto label = fmt::format(FMT_STRING("GX Shader {:x}"), hash);
-  const auto shaderDescriptor = wgpu::ShaderModuleDescriptor{
-      .nextInChain = &wgslDescriptor,
-      .label = label.c_str(),
-  };
-  auto shader = webgpu::g_device.CreateShaderModule(&shaderDescriptor);
-
-  auto pair = std::make_pair(shader, info);
-  g_gxCachedShaders.emplace(hash, pair);
-#ifndef NDEBUG
-  g_gxCachedShaderConfigs.emplace(hash, config);
-#endif
-
-  return pair.first;
+                                        vtxInAttrs, vtxXfrAttrs, fragmentFn, fragmentFnPre, vtxXfrAttrsPre, uniformPre,
+                                        MatrixFns, frameBufAttrs, drawBinding);
+  return create_shader(hash, config, info, shaderSource);
 }
 } // namespace aurora::gfx::gx
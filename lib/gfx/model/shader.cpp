@@ -45,12 +45,22 @@ struct DisplayListCache {
   ByteBuffer vtxBuf;
   ByteBuffer idxBuf;
   IndexedAttrs indexedAttrs;
+  u32 vtxCount;
 
-  DisplayListCache(ByteBuffer&& vtxBuf, ByteBuffer&& idxBuf, IndexedAttrs indexedAttrs)
-  : vtxBuf(std::move(vtxBuf)), idxBuf(std::move(idxBuf)), indexedAttrs(indexedAttrs) {}
+  DisplayListCache(ByteBuffer&& vtxBuf, ByteBuffer&& idxBuf, IndexedAttrs indexedAttrs, u32 vtxCount)
+  : vtxBuf(std::move(vtxBuf)), idxBuf(std::move(idxBuf)), indexedAttrs(indexedAttrs), vtxCount(vtxCount) {}
 };
 
 static absl::flat_hash_map<HashType, DisplayListCache> sCachedDisplayLists;
+// Content hashes of display lists called by address (GXCallDisplayListStatic), until invalidated. Entries with
+// another size are stale.
+struct DisplayListIdentity {
+  u32 size;
+  HashType hash;
+};
+static absl::flat_hash_map<const u8*, DisplayListIdentity> sDisplayListIdentities;
+// Of the last surface. Draw commands only record storage offsets, which may repeat across resident buffers.
+static gx::BindGroupRanges sLastRanges;
 
 static u32 prepare_vtx_buffer(ByteBuffer& buf, GXVtxFmt vtxfmt, const u8* ptr, u16 vtxCount,
                               IndexedAttrs& indexedAttrs) {
@@ -266,17 +276,44 @@ static u16 prepare_idx_buffer(ByteBuffer& buf, GXPrimitive prim, u16 vtxStart, u
   return numIndices;
 }
 
-void queue_surface(const u8* dlStart, u32 dlSize) noexcept {
+static HashType display_list_hash(const u8* dlStart, u32 dlSize, bool byAddress) {
+  if (!byAddress) {
+    return xxh3_hash_s(dlStart, dlSize, 0);
+  }
+  const auto it = sDisplayListIdentities.find(dlStart);
+  if (it != sDisplayListIdentities.end() && it->second.size == dlSize) {
+    if (g_config.verifyDisplayLists) {
+      const auto hash = xxh3_hash_s(dlStart, dlSize, 0);
+      if (hash != it->second.hash) {
+        Log.report(LOG_WARNING, FMT_STRING("Display list {} ({} bytes) changed without GXInvalidateDisplayList"),
+                   static_cast<const void*>(dlStart), dlSize);
+        it->second.hash = hash;
+      }
+    }
+    return it->second.hash;
+  }
   const auto hash = xxh3_hash_s(dlStart, dlSize, 0);
+  sDisplayListIdentities.insert_or_assign(dlStart, DisplayListIdentity{dlSize, hash});
+  return hash;
+}
+
+void invalidate_display_list(const u8* dlStart) noexcept { sDisplayListIdentities.erase(dlStart); }
+
+void invalidate_display_lists() noexcept { sDisplayListIdentities.clear(); }
+
+void queue_surface(const u8* dlStart, u32 dlSize, bool byAddress) noexcept {
+  const auto hash = display_list_hash(dlStart, dlSize, byAddress);
   Range vertRange, idxRange;
   u32 numIndices = 0;
+  u32 vtxCount = 0;
   IndexedAttrs indexedAttrs{};
   auto it = sCachedDisplayLists.find(hash);
   if (it != sCachedDisplayLists.end()) {
     const auto& cache = it->second;
     numIndices = cache.idxBuf.size() / 2;
-    vertRange = push_verts(cache.vtxBuf.data(), cache.vtxBuf.size());
-    idxRange = push_indices(cache.idxBuf.data(), cache.idxBuf.size());
+    vtxCount = cache.vtxCount;
+    std::tie(vertRange, idxRange) = push_display_list(hash, {cache.vtxBuf.data(), cache.vtxBuf.size()},
+                                                      {cache.idxBuf.data(), cache.idxBuf.size()}, vtxCount);
     indexedAttrs = cache.indexedAttrs;
   } else {
     const u8* data = dlStart;
@@ -317,9 +354,10 @@ void queue_surface(const u8* dlStart, u32 dlSize) noexcept {
         break;
       }
     }
-    vertRange = push_verts(vtxBuf.data(), vtxBuf.size());
-    idxRange = push_indices(idxBuf.data(), idxBuf.size());
-    sCachedDisplayLists.try_emplace(hash, std::move(vtxBuf), std::move(idxBuf), indexedAttrs);
+    vtxCount = vtxStart;
+    std::tie(vertRange, idxRange) =
+        push_display_list(hash, {vtxBuf.data(), vtxBuf.size()}, {idxBuf.data(), idxBuf.size()}, vtxCount);
+    sCachedDisplayLists.try_emplace(hash, std::move(vtxBuf), std::move(idxBuf), indexedAttrs, vtxCount);
   }
 
   gx::BindGroupRanges ranges{};
@@ -339,28 +377,58 @@ void queue_surface(const u8* dlStart, u32 dlSize) noexcept {
       ranges.vaRanges[i] = array.cachedRange;
     } else {
       // Push array data to storage and cache range
-      const auto range = push_storage(static_cast<const uint8_t*>(array.data), array.size);
+      const auto range = push_vertex_array(static_cast<const uint8_t*>(array.data), array.size);
       ranges.vaRanges[i] = range;
       array.cachedRange = range;
     }
     lastIndexedAttr = i;
   }
+  const bool sameRanges = ranges.vaRanges == sLastRanges.vaRanges;
+  sLastRanges = ranges;
 
-  model::PipelineConfig config{};
-  populate_pipeline_config(config, GX_TRIANGLES);
-  const auto info = gx::build_shader_info(config.shaderConfig);
-  const auto bindGroups = gx::build_bind_groups(info, config.shaderConfig, ranges);
-  const auto pipeline = pipeline_ref(config);
+  if (gx::g_gxState.dirtyState == 0 && sameRanges && merge_draw_command(model::DrawData{
+                                                         .vertRange = vertRange,
+                                                         .idxRange = idxRange,
+                                                         .dataRanges = ranges,
+                                                         .indexCount = numIndices,
+                                                         .vtxCount = vtxCount,
+                                                     })) {
+    // Same material as the last display list
+    return;
+  }
+
+  PipelineRef pipeline;
+  UniformRanges uniformRanges;
+  gx::GXBindGroups bindGroups;
+  bool perDrawStorage;
+  if (const auto* last = gx::reusable_draw(ShaderType::Model)) {
+    // Only uniform state changed
+    pipeline = last->pipeline;
+    uniformRanges = gx::build_uniform(last->shaderConfig, last->info);
+    bindGroups = gx::build_bind_groups(last->info, last->shaderConfig, ranges, uniformRanges);
+    perDrawStorage = last->info.perDrawStorage;
+    gx::g_gxState.dirtyState = 0;
+  } else {
+    model::PipelineConfig config{};
+    populate_pipeline_config(config, GX_TRIANGLES);
+    auto info = gx::build_shader_info(config.shaderConfig);
+    std::tie(pipeline, uniformRanges) = gx::build_pipeline_uniform(config, info);
+    bindGroups = gx::build_bind_groups(info, config.shaderConfig, ranges, uniformRanges);
+    gx::set_last_draw(ShaderType::Model, pipeline, config, info, bindGroups, uniformRanges);
+    perDrawStorage = info.perDrawStorage;
+  }
 
   push_draw_command(model::DrawData{
       .pipeline = pipeline,
       .vertRange = vertRange,
       .idxRange = idxRange,
       .dataRanges = ranges,
-      .uniformRange = build_uniform(info),
+      .uniformRanges = uniformRanges,
       .indexCount = numIndices,
+      .vtxCount = vtxCount,
       .bindGroups = bindGroups,
       .dstAlpha = gx::g_gxState.dstAlpha,
+      .perDrawStorage = perDrawStorage,
   });
 }
 
@@ -458,33 +526,26 @@ wgpu::RenderPipeline create_pipeline(const State& state, [[maybe_unused]] const
   return build_pipeline(config, info, vtxBuffers, shader, "GX Pipeline");
 }
 
-void render(const State& state, const DrawData& data, const wgpu::RenderPassEncoder& pass) {
-  if (!bind_pipeline(data.pipeline, pass)) {
+void render(const State& state, const gx::DrawCommand& draw, const wgpu::RenderPassEncoder& pass) {
+  if (!bind_pipeline(draw.pipeline, pass)) {
     return;
   }
 
-  std::array<uint32_t, GX_VA_MAX_ATTR + 1> offsets{data.uniformRange.offset};
-  uint32_t bindIdx = 1;
-  for (uint32_t i = 0; i < GX_VA_MAX_ATTR; ++i) {
-    const auto& range = data.dataRanges.vaRanges[i];
-    if (range.size <= 0) {
-      continue;
-    }
-    offsets[bindIdx] = range.offset;
-    ++bindIdx;
-  }
-  pass.SetBindGroup(0, find_bind_group(data.bindGroups.uniformBindGroup), bindIdx, offsets.data());
-  if (data.bindGroups.samplerBindGroup && data.bindGroups.textureBindGroup) {
-    pass.SetBindGroup(1, find_bind_group(data.bindGroups.samplerBindGroup));
-    pass.SetBindGroup(2, find_bind_group(data.bindGroups.textureBindGroup));
+  std::array<uint32_t, gx::MaxUniformBlocks + GX_VA_MAX_ATTR> offsets;
+  const u32 uniformOffsets = gx::uniform_offsets(draw, offsets.data());
+  std::copy(draw.storageOffsets.begin(), draw.storageOffsets.end(), offsets.begin() + uniformOffsets);
+  bind_group(0, draw.bindGroups.uniformBindGroup, {offsets.data(), draw.storageOffsets.size() + uniformOffsets},
+             pass);
+  if (draw.bindGroups.samplerBindGroup && draw.bindGroups.textureBindGroup) {
+    bind_group(1, draw.bindGroups.samplerBindGroup, {}, pass);
+    bind_group(2, draw.bindGroups.textureBindGroup, {}, pass);
   }
-  pass.SetVertexBuffer(0, g_vertexBuffer, data.vertRange.offset, data.vertRange.size);
-  pass.SetIndexBuffer(g_indexBuffer, wgpu::IndexFormat::Uint16, data.idxRange.offset, data.idxRange.size);
-  if (data.dstAlpha != UINT32_MAX) {
-    const wgpu::Color color{0.f, 0.f, 0.f, data.dstAlpha / 255.f};
-    pass.SetBlendConstant(&color);
+  bind_vertex_buffer(draw.vertRange, pass);
+  bind_index_buffer(draw.indexRange, draw.indexFormat, pass);
+  if (draw.dstAlpha != UINT32_MAX) {
+    set_blend_constant({0.f, 0.f, 0.f, draw.dstAlpha / 255.f}, pass);
   }
-  pass.DrawIndexed(data.indexCount);
+  pass.DrawIndexed(draw.indexCount, 1, 0, 0, draw.firstInstance);
 }
 } // namespace aurora::gfx::model
 
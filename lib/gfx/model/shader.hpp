@@ -9,10 +9,12 @@ struct DrawData {
   Range vertRange;
   Range idxRange;
   gx::BindGroupRanges dataRanges;
-  Range uniformRange;
+  UniformRanges uniformRanges;
   uint32_t indexCount;
+  uint32_t vtxCount;
   gx::GXBindGroups bindGroups;
   u32 dstAlpha;
+  bool perDrawStorage;
 };
 
 struct PipelineConfig : gx::PipelineConfig {};
@@ -21,7 +23,10 @@ struct State {};
 
 State construct_state();
 wgpu::RenderPipeline create_pipeline(const State& state, [[maybe_unused]] const PipelineConfig& config);
-void render(const State& state, const DrawData& data, const wgpu::RenderPassEncoder& pass);
+void render(const State& state, const gx::DrawCommand& draw, const wgpu::RenderPassEncoder& pass);
 
-void queue_surface(const u8* dlStart, u32 dlSize) noexcept;
+// byAddress looks the display list up by address & size until invalidated, instead of hashing its contents
+void queue_surface(const u8* dlStart, u32 dlSize, bool byAddress) noexcept;
+void invalidate_display_list(const u8* dlStart) noexcept;
+void invalidate_display_lists() noexcept;
 } // namespace aurora::gfx::model
@@ -0,0 +1,382 @@
+#include "pipeline_cache.hpp"
+
+#include "../internal.hpp"
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/node_hash_map.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace aurora::gfx::pipeline_cache {
+static Module Log("aurora::gfx::pipeline_cache");
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t CacheMagic = 0x43504C41; // ALPC
+constexpr uint32_t CacheVersion = 2;
+// Entries unused for this many sessions are dropped
+constexpr uint32_t PruneSessions = 8;
+// EntryHeader::type of a tag membership record, whose payload is a PipelineRef followed by the tag name
+constexpr uint32_t TagRecordType = UINT32_MAX;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t session;
+  uint32_t _pad;
+};
+static_assert(sizeof(FileHeader) == 16);
+// Followed by configSize bytes of PipelineConfig (or tag payload). A pipeline may appear more than once,
+// later entries (first use in a later session) replace earlier ones.
+struct EntryHeader {
+  uint64_t checksum; // Rest of the header + config
+  uint32_t type;
+  uint32_t configSize;
+  uint32_t firstFrame; // Frame of first use in lastSession
+  uint32_t useCount;   // Number of sessions used in
+  uint32_t lastSession;
+  uint32_t _pad;
+};
+static_assert(sizeof(EntryHeader) == 32);
+
+class MappedFile {
+public:
+  explicit MappedFile(const fs::path& path) {
+#ifdef _WIN32
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                         nullptr);
+    LARGE_INTEGER size;
+    if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+      return;
+    }
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+      return;
+    }
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data != nullptr) {
+      m_size = static_cast<size_t>(size.QuadPart);
+    }
+#else
+    m_fd = open(path.c_str(), O_RDONLY);
+    struct stat st {};
+    if (m_fd < 0 || fstat(m_fd, &st) != 0 || st.st_size == 0) {
+      return;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data != MAP_FAILED) {
+      m_data = static_cast<const uint8_t*>(data);
+      m_size = st.st_size;
+    }
+#endif
+  }
+  ~MappedFile() {
+#ifdef _WIN32
+    if (m_data != nullptr) {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+      CloseHandle(m_file);
+    }
+#else
+    if (m_data != nullptr) {
+      munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+#endif
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+#else
+  int m_fd = -1;
+#endif
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+struct Entry {
+  EntryHeader header;
+  std::vector<uint8_t> config;
+};
+struct Tag {
+  std::string name;
+  // Pipeline -> last session it was used inside this tag
+  absl::flat_hash_map<PipelineRef, uint32_t> members;
+  std::vector<PipelineRef> order;
+};
+
+static fs::path g_path;
+static uint32_t g_session = 0;
+static std::ofstream g_file;
+static absl::flat_hash_map<PipelineRef, Entry> g_entries;
+// Node map, active tags are referenced by pointer
+static absl::node_hash_map<std::string, Tag> g_tags;
+static std::vector<Tag*> g_activeTags;
+
+static uint64_t entry_checksum(const EntryHeader& header, const void* config) {
+  const auto seed = XXH3_64bits(reinterpret_cast<const uint8_t*>(&header) + sizeof(header.checksum),
+                                sizeof(EntryHeader) - sizeof(header.checksum));
+  return XXH3_64bits_withSeed(config, header.configSize, seed);
+}
+
+static void append_entry(ByteBuffer& out, EntryHeader header, const void* config) {
+  header.checksum = entry_checksum(header, config);
+  out.append(&header, sizeof(header));
+  out.append(config, header.configSize);
+}
+
+static void append_tag_record(ByteBuffer& out, const Tag& tag, PipelineRef ref, uint32_t session) {
+  ByteBuffer payload;
+  payload.append(&ref, sizeof(ref));
+  payload.append(tag.name.data(), tag.name.size());
+  append_entry(out,
+               EntryHeader{
+                   .type = TagRecordType,
+                   .configSize = static_cast<uint32_t>(payload.size()),
+                   .lastSession = session,
+               },
+               payload.data());
+}
+
+static void write_file(const ByteBuffer& buf) {
+  if (g_file) {
+    g_file.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    g_file.flush();
+  }
+}
+
+void initialize(uint32_t configVersion, const ReplayCallback& replay) {
+  g_path = fs::path{g_config.configPath} / "pipeline_cache.bin";
+
+  uint32_t lastSession = 0;
+  ByteBuffer out;
+  {
+    struct LiveEntry {
+      EntryHeader header;
+      const uint8_t* config;
+    };
+    absl::flat_hash_map<PipelineRef, LiveEntry> entries;
+    size_t staleCount = 0;
+    size_t outdatedCount = 0;
+    MappedFile file{g_path};
+    FileHeader fileHeader{};
+    if (file.size() >= sizeof(FileHeader)) {
+      memcpy(&fileHeader, file.data(), sizeof(FileHeader));
+    }
+    if (fileHeader.magic == CacheMagic && fileHeader.version == CacheVersion) {
+      lastSession = fileHeader.session;
+      size_t offset = sizeof(FileHeader);
+      while (file.size() - offset >= sizeof(EntryHeader)) {
+        EntryHeader header;
+        memcpy(&header, file.data() + offset, sizeof(EntryHeader));
+        offset += sizeof(EntryHeader);
+        const uint8_t* config = file.data() + offset;
+        if (header.configSize > file.size() - offset || entry_checksum(header, config) != header.checksum) {
+          // Torn append from a crash; nothing after it can be trusted
+          Log.report(LOG_WARNING, FMT_STRING("Truncated pipeline cache at offset {}"), offset - sizeof(EntryHeader));
+          break;
+        }
+        offset += header.configSize;
+        if (header.lastSession + PruneSessions <= lastSession) {
+          ++staleCount;
+          continue;
+        }
+        if (header.type == TagRecordType) {
+          if (header.configSize < sizeof(PipelineRef)) {
+            continue;
+          }
+          PipelineRef ref;
+          memcpy(&ref, config, sizeof(ref));
+          std::string name{reinterpret_cast<const char*>(config) + sizeof(ref), header.configSize - sizeof(ref)};
+          auto& tag = g_tags[name];
+          tag.name = std::move(name);
+          auto [it, inserted] = tag.members.try_emplace(ref, header.lastSession);
+          if (inserted) {
+            tag.order.push_back(ref);
+          } else {
+            it->second = std::max(it->second, header.lastSession);
+          }
+          continue;
+        }
+        uint32_t version = 0;
+        if (header.configSize >= sizeof(version)) {
+          memcpy(&version, config, sizeof(version));
+        }
+        if (version != configVersion) {
+          // Never replayed; its tag memberships are dropped below with the pruned entries
+          ++outdatedCount;
+          continue;
+        }
+        const auto ref = xxh3_hash_s(config, header.configSize, static_cast<HashType>(header.type));
+        entries.insert_or_assign(ref, LiveEntry{header, config});
+      }
+    } else if (file.size() > 0) {
+      Log.report(LOG_INFO, FMT_STRING("Discarding pipeline cache with unknown version"));
+    }
+
+    std::vector<std::pair<PipelineRef, LiveEntry>> sorted{entries.begin(), entries.end()};
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+      if (a.second.header.lastSession != b.second.header.lastSession) {
+        return a.second.header.lastSession > b.second.header.lastSession;
+      }
+      return a.second.header.firstFrame < b.second.header.firstFrame;
+    });
+    g_session = lastSession + 1;
+    const FileHeader newHeader{
+        .magic = CacheMagic,
+        .version = CacheVersion,
+        .session = g_session,
+    };
+    out.append(&newHeader, sizeof(newHeader));
+    for (const auto& [ref, entry] : sorted) {
+      append_entry(out, entry.header, entry.config);
+      g_entries.try_emplace(ref, Entry{entry.header, {entry.config, entry.config + entry.header.configSize}});
+      replay(static_cast<ShaderType>(entry.header.type), entry.config, entry.header.configSize);
+    }
+    for (auto& [name, tag] : g_tags) {
+      // Drop members whose pipeline was pruned
+      std::erase_if(tag.order, [&](PipelineRef ref) {
+        if (entries.contains(ref)) {
+          return false;
+        }
+        tag.members.erase(ref);
+        return true;
+      });
+      for (const auto ref : tag.order) {
+        append_tag_record(out, tag, ref, tag.members[ref]);
+      }
+    }
+    if (staleCount > 0) {
+      Log.report(LOG_INFO, FMT_STRING("Pruned {} unused pipeline cache entries"), staleCount);
+    }
+    if (outdatedCount > 0) {
+      Log.report(LOG_INFO, FMT_STRING("Dropped {} pipeline cache entries from an older version"), outdatedCount);
+    }
+  }
+
+  // Rewrite compacted; the rename keeps either the old or the new file intact
+  auto tmpPath = g_path;
+  tmpPath += ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+  }
+  std::error_code ec;
+  fs::rename(tmpPath, g_path, ec);
+  if (ec) {
+    Log.report(LOG_WARNING, FMT_STRING("Failed to write {}: {}"), g_path.string(), ec.message());
+    return;
+  }
+  g_file.open(g_path, std::ios::out | std::ios::app | std::ios::binary);
+}
+
+void record_use(ShaderType type, PipelineRef ref, const void* config, uint32_t configSize, uint32_t frame) {
+  auto [it, inserted] = g_entries.try_emplace(ref);
+  auto& entry = it->second;
+  if (inserted || entry.header.lastSession != g_session) {
+    entry.header = {
+        .type = static_cast<uint32_t>(type),
+        .configSize = configSize,
+        .firstFrame = frame,
+        .useCount = entry.header.useCount + 1,
+        .lastSession = g_session,
+    };
+    if (inserted) {
+      const auto* bytes = static_cast<const uint8_t*>(config);
+      entry.config.assign(bytes, bytes + configSize);
+    }
+    ByteBuffer buf;
+    append_entry(buf, entry.header, config);
+    write_file(buf);
+  }
+  for (auto* tag : g_activeTags) {
+    auto [memberIt, newMember] = tag->members.try_emplace(ref, g_session);
+    if (!newMember && memberIt->second == g_session) {
+      continue;
+    }
+    memberIt->second = g_session;
+    if (newMember) {
+      tag->order.push_back(ref);
+    }
+    ByteBuffer buf;
+    append_tag_record(buf, *tag, ref, g_session);
+    write_file(buf);
+  }
+}
+
+void begin_tag(std::string_view name) {
+  auto& tag = g_tags[std::string{name}];
+  tag.name = name;
+  g_activeTags.push_back(&tag);
+}
+
+void end_tag() {
+  if (g_activeTags.empty()) {
+    Log.report(LOG_WARNING, FMT_STRING("end_tag without matching begin_tag"));
+    return;
+  }
+  g_activeTags.pop_back();
+}
+
+size_t precompile_tag(std::string_view name, const ReplayCallback& replay) {
+  const auto it = g_tags.find(std::string{name});
+  if (it == g_tags.end()) {
+    Log.report(LOG_INFO, FMT_STRING("No cached pipelines for tag {}"), name);
+    return 0;
+  }
+  for (const auto ref : it->second.order) {
+    const auto& entry = g_entries[ref];
+    replay(static_cast<ShaderType>(entry.header.type), entry.config.data(), entry.header.configSize);
+  }
+  return it->second.order.size();
+}
+
+float tag_progress(std::string_view name) {
+  const auto it = g_tags.find(std::string{name});
+  if (it == g_tags.end() || it->second.order.empty()) {
+    return 100.f;
+  }
+  size_t ready = 0;
+  for (const auto ref : it->second.order) {
+    if (pipeline_ready(ref)) {
+      ++ready;
+    }
+  }
+  return 100.f * static_cast<float>(ready) / static_cast<float>(it->second.order.size());
+}
+
+void shutdown() {
+  g_file.close();
+  g_entries.clear();
+  g_tags.clear();
+  g_activeTags.clear();
+}
+} // namespace aurora::gfx::pipeline_cache
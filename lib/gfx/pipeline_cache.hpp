@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <functional>
+#include <string_view>
+
+namespace aurora::gfx::pipeline_cache {
+using ReplayCallback = std::function<void(ShaderType type, const uint8_t* config, uint32_t configSize)>;
+
+// Maps pipeline_cache.bin, replays the live entries in the order they were first needed (most recent session
+// first), then rewrites the file pruned & deduplicated for this session. Configs start with a u32 version;
+// entries of any other version are dropped without being replayed.
+void initialize(uint32_t configVersion, const ReplayCallback& replay);
+// Records the first use of a pipeline this session; the entry is appended to the file immediately.
+// Main thread only.
+void record_use(ShaderType type, PipelineRef ref, const void* config, uint32_t configSize, uint32_t frame);
+// Pipelines used between begin_tag & end_tag are recorded as members of every active tag. Tags may nest.
+void begin_tag(std::string_view name);
+void end_tag();
+// Calls replay for every cached member of the tag; returns the member count.
+size_t precompile_tag(std::string_view name, const ReplayCallback& replay);
+// Percentage of the tag's members that are ready to draw
+float tag_progress(std::string_view name);
+void shutdown();
+} // namespace aurora::gfx::pipeline_cache
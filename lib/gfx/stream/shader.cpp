@@ -60,23 +60,23 @@ wgpu::RenderPipeline create_pipeline(const State& state, [[maybe_unused]] const
 
 State construct_state() { return {}; }
 
-void render(const State& state, const DrawData& data, const wgpu::RenderPassEncoder& pass) {
-  if (!bind_pipeline(data.pipeline, pass)) {
+void render(const State& state, const gx::DrawCommand& draw, const wgpu::RenderPassEncoder& pass) {
+  if (!bind_pipeline(draw.pipeline, pass)) {
     return;
   }
 
-  const std::array offsets{data.uniformRange.offset};
-  pass.SetBindGroup(0, find_bind_group(data.bindGroups.uniformBindGroup), offsets.size(), offsets.data());
-  if (data.bindGroups.samplerBindGroup && data.bindGroups.textureBindGroup) {
-    pass.SetBindGroup(1, find_bind_group(data.bindGroups.samplerBindGroup));
-    pass.SetBindGroup(2, find_bind_group(data.bindGroups.textureBindGroup));
+  std::array<uint32_t, gx::MaxUniformBlocks> offsets;
+  const u32 uniformOffsets = gx::uniform_offsets(draw, offsets.data());
+  bind_group(0, draw.bindGroups.uniformBindGroup, {offsets.data(), uniformOffsets}, pass);
+  if (draw.bindGroups.samplerBindGroup && draw.bindGroups.textureBindGroup) {
+    bind_group(1, draw.bindGroups.samplerBindGroup, {}, pass);
+    bind_group(2, draw.bindGroups.textureBindGroup, {}, pass);
   }
-  pass.SetVertexBuffer(0, g_vertexBuffer, data.vertRange.offset, data.vertRange.size);
-  pass.SetIndexBuffer(g_indexBuffer, wgpu::IndexFormat::Uint16, data.indexRange.offset, data.indexRange.size);
-  if (data.dstAlpha != UINT32_MAX) {
-    const wgpu::Color color{0.f, 0.f, 0.f, data.dstAlpha / 255.f};
-    pass.SetBlendConstant(&color);
+  bind_vertex_buffer(draw.vertRange, pass);
+  bind_index_buffer(draw.indexRange, draw.indexFormat, pass);
+  if (draw.dstAlpha != UINT32_MAX) {
+    set_blend_constant({0.f, 0.f, 0.f, draw.dstAlpha / 255.f}, pass);
   }
-  pass.DrawIndexed(data.indexCount);
+  pass.DrawIndexed(draw.indexCount, 1, 0, 0, draw.firstInstance);
 }
 } // namespace aurora::gfx::stream
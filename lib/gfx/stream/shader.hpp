@@ -7,11 +7,13 @@ namespace aurora::gfx::stream {
 struct DrawData {
   PipelineRef pipeline;
   Range vertRange;
-  Range uniformRange;
+  UniformRanges uniformRanges;
   Range indexRange;
   uint32_t indexCount;
+  uint32_t vtxCount;
   gx::GXBindGroups bindGroups;
   u32 dstAlpha;
+  bool perDrawStorage;
 };
 
 struct PipelineConfig : public gx::PipelineConfig {};
@@ -20,5 +22,5 @@ struct State {};
 
 State construct_state();
 wgpu::RenderPipeline create_pipeline(const State& state, [[maybe_unused]] const PipelineConfig& config);
-void render(const State& state, const DrawData& data, const wgpu::RenderPassEncoder& pass);
+void render(const State& state, const gx::DrawCommand& draw, const wgpu::RenderPassEncoder& pass);
 } // namespace aurora::gfx::stream
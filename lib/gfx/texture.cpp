@@ -78,7 +78,7 @@ TextureHandle new_static_texture_2d(uint32_t width, uint32_t height, uint32_t mi
         .rowsPerImage = heightBlocks,
     };
     // TODO
-    //    g_textureUploads.emplace_back(dataLayout, std::move(dstView), physicalSize);
+    //    g_textureUploads.emplace_back(dataLayout, std::move(dstView), physicalSize, range.chunk);
     g_queue.WriteTexture(&dstView, data.data() + offset, dataSize, &dataLayout, &physicalSize);
     offset += dataSize;
   }
@@ -183,7 +183,7 @@ void write_texture(const TextureRef& ref, ArrayRef<uint8_t> data) noexcept {
     //        .bytesPerRow = bytesPerRow,
     //        .rowsPerImage = heightBlocks,
     //    };
-    //    g_textureUploads.emplace_back(dataLayout, std::move(dstView), physicalSize);
+    //    g_textureUploads.emplace_back(dataLayout, std::move(dstView), physicalSize, range.chunk);
     const wgpu::ImageCopyTexture dstView{
         .texture = ref.texture,
         .mipLevel = mip,
@@ -8,9 +8,11 @@ struct TextureUpload {
   wgpu::TextureDataLayout layout;
   wgpu::ImageCopyTexture tex;
   wgpu::Extent3D size;
+  uint32_t chunk; // Texture upload buffer chunk holding the data
 
-  TextureUpload(wgpu::TextureDataLayout layout, wgpu::ImageCopyTexture tex, wgpu::Extent3D size) noexcept
-  : layout(layout), tex(tex), size(size) {}
+  TextureUpload(wgpu::TextureDataLayout layout, wgpu::ImageCopyTexture tex, wgpu::Extent3D size,
+                uint32_t chunk) noexcept
+  : layout(layout), tex(tex), size(size), chunk(chunk) {}
 };
 extern std::vector<TextureUpload> g_textureUploads;
 
@@ -33,6 +35,7 @@ struct TextureRef {
   , mipCount(mipCount)
   , gxFormat(gxFormat)
   , isRenderTexture(isRenderTexture) {}
+  ~TextureRef() { release_bind_groups(view); }
 };
 
 TextureHandle new_static_texture_2d(uint32_t width, uint32_t height, uint32_t mips, u32 format, ArrayRef<uint8_t> data,
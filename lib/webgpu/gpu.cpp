@@ -9,10 +9,12 @@
 #include <magic_enum.hpp>
 #include <memory>
 #include <algorithm>
+#include <filesystem>
 
 #ifdef WEBGPU_DAWN
 #include <dawn/native/DawnNative.h>
 #include "../dawn/BackendBinding.hpp"
+#include "../dawn/BlobCache.hpp"
 #endif
 
 namespace aurora::webgpu {
@@ -34,8 +36,10 @@ wgpu::BindGroup g_CopyBindGroup;
 
 #ifdef WEBGPU_DAWN
 static std::unique_ptr<dawn::native::Instance> g_dawnInstance;
+static std::unique_ptr<utils::BlobCachePlatform> g_dawnPlatform;
 static dawn::native::Adapter g_adapter;
 static std::unique_ptr<utils::BackendBinding> g_backendBinding;
+constexpr uint64_t BlobCacheSize = 256 * 1024 * 1024;
 #else
 wgpu::Instance g_instance;
 static wgpu::Adapter g_adapter;
@@ -337,6 +341,10 @@ bool initialize(AuroraBackend auroraBackend) {
   if (!g_dawnInstance) {
     Log.report(LOG_INFO, FMT_STRING("Creating Dawn instance"));
     g_dawnInstance = std::make_unique<dawn::native::Instance>();
+    // Persist compiled backend shaders & pipelines across runs
+    const auto cachePath = std::filesystem::path{g_config.configPath} / "dawn_cache";
+    g_dawnPlatform = std::make_unique<utils::BlobCachePlatform>(cachePath, BlobCacheSize);
+    g_dawnInstance->SetPlatform(g_dawnPlatform.get());
   }
 #else
   if (!g_instance) {
@@ -424,6 +432,9 @@ bool initialize(AuroraBackend auroraBackend) {
   }
   Log.report(LOG_INFO, FMT_STRING("Graphics adapter information\n  API: {}\n  Device: {} ({})\n  Driver: {}"),
              backendName, adapterName, magic_enum::enum_name(g_adapterProperties.adapterType), driverDescription);
+#ifdef WEBGPU_DAWN
+  g_dawnPlatform->SetAdapter(g_adapterProperties);
+#endif
 
   {
 // TODO: emscripten doesn't implement wgpuAdapterGetLimits
@@ -557,8 +568,13 @@ void shutdown() {
   wgpuDeviceDestroy(g_device.Release());
   g_adapter = {};
 #ifdef WEBGPU_DAWN
+  if (const auto* cache = g_dawnPlatform ? g_dawnPlatform->GetBlobCache() : nullptr) {
+    Log.report(LOG_INFO, FMT_STRING("Blob cache: {} hits, {} misses, {} stores"), cache->hits.load(),
+               cache->misses.load(), cache->stores.load());
+  }
   g_backendBinding.reset();
   g_dawnInstance.reset();
+  g_dawnPlatform.reset();
 #else
   g_surface = {};
   g_instance = {};